@@ -1,32 +1,267 @@
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <array>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
 #include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// The board size is fixed at compile time. Build with
+// -DREVERSI_BOARD_SIZE=6 (make BOARD_SIZE=6) for another variant.
+#ifndef REVERSI_BOARD_SIZE
+#define REVERSI_BOARD_SIZE 8
+#endif
 
-const size_t BOARD_SIZE  = 8;
-const size_t BOARD_CELLS = BOARD_SIZE * BOARD_SIZE;
-const std::string INITIAL_BOARD =
-"........"
-"........"
-"........"
-"...OX..."
-"...XO..."
-"........"
-"........"
-"........";
 const size_t MIN_VISITS_TO_EXPAND = 1;
 const float EXPLORATION_CONST = M_SQRT2;
 
+// The narrowest unsigned type with a bit for every square.
+template<size_t CELLS, bool = (CELLS <= 32), bool = (CELLS <= 64)>
+struct BitboardType {
+    static_assert(CELLS <= 128, "no bitboard type is wide enough");
+    typedef unsigned __int128 type;
+};
+
+template<size_t CELLS>
+struct BitboardType<CELLS, true, true> {
+    typedef uint32_t type;
+};
+
+template<size_t CELLS>
+struct BitboardType<CELLS, false, true> {
+    typedef uint64_t type;
+};
+
+const size_t NUM_DIRECTIONS = 8;
+
+// Square x + y * N is bit x + y * N. Directions run east, south-east,
+// south, south-west and then the same four the other way round; a shift
+// is masked so that nothing wraps around a side or falls off the board.
+template<size_t N>
+struct BoardGeometry {
+    static_assert(N >= 4 && N % 2 == 0, "the start position needs an even board");
+
+    typedef typename BitboardType<N * N>::type Bitboard;
+
+    static constexpr size_t CELLS = N * N;
+
+    static constexpr Bitboard fileMask(size_t x) {
+        Bitboard mask = 0;
+        for (size_t y = 0; y < N; ++y) {
+            mask |= static_cast<Bitboard>(1) << (x + y * N);
+        }
+        return mask;
+    }
+
+    static constexpr Bitboard ALL_SQUARES = (CELLS == 8 * sizeof(Bitboard))
+        ? ~static_cast<Bitboard>(0) : (static_cast<Bitboard>(1) << (CELLS % (8 * sizeof(Bitboard)))) - 1;
+    static constexpr Bitboard NOT_FIRST_FILE = ALL_SQUARES & ~fileMask(0);
+    static constexpr Bitboard NOT_LAST_FILE = ALL_SQUARES & ~fileMask(N - 1);
+
+    static constexpr int DIRECTION_SHIFTS[NUM_DIRECTIONS] = {
+        1, N + 1, N, N - 1, -1, -static_cast<int>(N + 1), -static_cast<int>(N), -static_cast<int>(N - 1)
+    };
+    static constexpr Bitboard DIRECTION_MASKS[NUM_DIRECTIONS] = {
+        NOT_FIRST_FILE, NOT_FIRST_FILE, ALL_SQUARES, NOT_LAST_FILE,
+        NOT_LAST_FILE, NOT_LAST_FILE, ALL_SQUARES, NOT_FIRST_FILE
+    };
+
+    static constexpr Bitboard squareMask(size_t x, size_t y) {
+        return static_cast<Bitboard>(1) << (x + y * N);
+    }
+
+    static constexpr Bitboard rankMask(size_t y) {
+        return ((static_cast<Bitboard>(1) << N) - 1) << (y * N);
+    }
+
+    static constexpr Bitboard CORNERS = squareMask(0, 0) | squareMask(N - 1, 0) | squareMask(0, N - 1) | squareMask(N - 1, N - 1);
+    static constexpr Bitboard EDGES = (fileMask(0) | fileMask(N - 1) | rankMask(0) | rankMask(N - 1)) & ~CORNERS;
+
+    // The C and X squares next to corner `c`, which hand the corner to the
+    // opponent while it is still empty.
+    static constexpr Bitboard cornerNeighbours(size_t c) {
+        const size_t x = (c % 2) ? N - 2 : 1;
+        const size_t y = (c / 2) ? N - 2 : 1;
+        const size_t cx = (c % 2) ? N - 1 : 0;
+        const size_t cy = (c / 2) ? N - 1 : 0;
+        return squareMask(x, cy) | squareMask(cx, y) | squareMask(x, y);
+    }
+
+    static constexpr Bitboard corner(size_t c) {
+        return squareMask((c % 2) ? N - 1 : 0, (c / 2) ? N - 1 : 0);
+    }
+
+    // The four corner quadrants, which the endgame solver orders moves by.
+    static constexpr Bitboard quadrant(size_t q) {
+        Bitboard mask = 0;
+        for (size_t y = 0; y < N / 2; ++y) {
+            for (size_t x = 0; x < N / 2; ++x) {
+                mask |= static_cast<Bitboard>(1) << (x + (q % 2) * (N / 2) + (y + (q / 2) * (N / 2)) * N);
+            }
+        }
+        return mask;
+    }
+};
+
+template<size_t N>
+constexpr int BoardGeometry<N>::DIRECTION_SHIFTS[NUM_DIRECTIONS];
+
+template<size_t N>
+constexpr typename BoardGeometry<N>::Bitboard BoardGeometry<N>::DIRECTION_MASKS[NUM_DIRECTIONS];
+
+// Every square's rays, nearest square first, in the direction order of
+// BoardGeometry. `directions` marks the rays with room for a flipped disc
+// and the disc that brackets it, so edges and corners skip the others.
+template<size_t N>
+struct RayTable {
+    typedef typename BoardGeometry<N>::Bitboard Bitboard;
+
+    Bitboard rays[N * N][NUM_DIRECTIONS];
+    uint8_t directions[N * N];
+
+    constexpr RayTable() : rays(), directions() {
+        const int dx[NUM_DIRECTIONS] = {1, 1, 0, -1, -1, -1, 0, 1};
+        const int dy[NUM_DIRECTIONS] = {0, 1, 1, 1, 0, -1, -1, -1};
+        for (size_t square = 0; square < N * N; ++square) {
+            for (size_t dir = 0; dir < NUM_DIRECTIONS; ++dir) {
+                size_t length = 0;
+                int x = square % N + dx[dir];
+                int y = square / N + dy[dir];
+                for (; 0 <= x && x < static_cast<int>(N) && 0 <= y && y < static_cast<int>(N); x += dx[dir], y += dy[dir]) {
+                    rays[square][dir] |= static_cast<Bitboard>(1) << (x + y * N);
+                    ++length;
+                }
+                if (length >= 2) {
+                    directions[square] |= 1 << dir;
+                }
+            }
+        }
+    }
+};
+
+template<size_t N>
+constexpr RayTable<N> RAYS = RayTable<N>();
+
+typedef BoardGeometry<REVERSI_BOARD_SIZE> Geometry;
+typedef Geometry::Bitboard Bitboard;
+
+const size_t BOARD_SIZE  = REVERSI_BOARD_SIZE;
+const size_t BOARD_CELLS = Geometry::CELLS;
+const Bitboard ALL_SQUARES = Geometry::ALL_SQUARES;
+const int* const DIRECTION_SHIFTS = Geometry::DIRECTION_SHIFTS;
+const Bitboard* const DIRECTION_MASKS = Geometry::DIRECTION_MASKS;
+
+inline size_t popCount(uint32_t bits) {
+    return __builtin_popcount(bits);
+}
+
+inline size_t popCount(uint64_t bits) {
+    return __builtin_popcountll(bits);
+}
+
+inline size_t popCount(unsigned __int128 bits) {
+    return popCount(static_cast<uint64_t>(bits)) + popCount(static_cast<uint64_t>(bits >> 64));
+}
+
+inline size_t lowestSquare(uint32_t bits) {
+    assert(bits);
+    return __builtin_ctz(bits);
+}
+
+inline size_t lowestSquare(uint64_t bits) {
+    assert(bits);
+    return __builtin_ctzll(bits);
+}
+
+inline size_t lowestSquare(unsigned __int128 bits) {
+    assert(bits);
+    const uint64_t low = static_cast<uint64_t>(bits);
+    return low ? lowestSquare(low) : 64 + lowestSquare(static_cast<uint64_t>(bits >> 64));
+}
+
+inline size_t highestSquare(uint32_t bits) {
+    assert(bits);
+    return 31 - __builtin_clz(bits);
+}
+
+inline size_t highestSquare(uint64_t bits) {
+    assert(bits);
+    return 63 - __builtin_clzll(bits);
+}
+
+inline size_t highestSquare(unsigned __int128 bits) {
+    assert(bits);
+    const uint64_t high = static_cast<uint64_t>(bits >> 64);
+    return high ? 64 + highestSquare(high) : highestSquare(static_cast<uint64_t>(bits));
+}
+
+inline size_t nthSquare(uint64_t bits, size_t n) {
+    assert(n < popCount(bits));
+#ifdef __BMI2__
+    return lowestSquare(static_cast<uint64_t>(_pdep_u64(static_cast<uint64_t>(1) << n, bits)));
+#else
+    for (; n > 0; --n) {
+        bits &= bits - 1;
+    }
+    return lowestSquare(bits);
+#endif
+}
+
+inline size_t nthSquare(uint32_t bits, size_t n) {
+    return nthSquare(static_cast<uint64_t>(bits), n);
+}
+
+inline size_t nthSquare(unsigned __int128 bits, size_t n) {
+    const uint64_t low = static_cast<uint64_t>(bits);
+    const size_t lowCount = popCount(low);
+    return (n < lowCount) ? nthSquare(low, n) : 64 + nthSquare(static_cast<uint64_t>(bits >> 64), n - lowCount);
+}
+
+// Folds a bitboard into 64 bits for hashing.
+inline uint64_t foldBits(uint32_t bits) {
+    return bits;
+}
+
+inline uint64_t foldBits(uint64_t bits) {
+    return bits;
+}
+
+inline uint64_t foldBits(unsigned __int128 bits) {
+    return static_cast<uint64_t>(bits) ^ (static_cast<uint64_t>(bits >> 64) * 0xc2b2ae3d27d4eb4fULL);
+}
+
 enum class Player {
     BLACK, WHITE
 };
 
+inline Player opponent(Player player) {
+    return (player == Player::BLACK) ? Player::WHITE : Player::BLACK;
+}
+
 enum class Cell {
     BLACK, WHITE, EMPTY
 };
@@ -55,387 +290,3261 @@ Cell parseCell(char chr) {
     assert(false && "unreachable");
 }
 
-class Board {
+template<size_t N>
+class BasicBoard {
 public:
-    Board(const std::string& str) {
+    typedef BoardGeometry<N> Geometry;
+    typedef typename Geometry::Bitboard Bitboard;
+
+    BasicBoard(const std::string& str, Player player = Player::BLACK) : own_(0), opp_(0), player_(player) {
+        Bitboard black = 0, white = 0;
         size_t idx = 0;
         for (const char chr : str) {
-            cells_.at(idx++) = parseCell(chr);
+            assert(idx < Geometry::CELLS);
+            switch (parseCell(chr)) {
+            case Cell::BLACK:
+                black |= squareBit(idx);
+                break;
+            case Cell::WHITE:
+                white |= squareBit(idx);
+                break;
+            case Cell::EMPTY:
+                break;
+            }
+            ++idx;
         }
-        assert(idx == BOARD_CELLS);
+        assert(idx == Geometry::CELLS);
+        own_ = (player == Player::BLACK) ? black : white;
+        opp_ = (player == Player::BLACK) ? white : black;
     }
 
-    Board() : Board(INITIAL_BOARD) {}
+    BasicBoard() : BasicBoard(getInitialBoard()) {}
 
-    Board(const Board& board) {
-        cells_ = board.cells_;
+    BasicBoard(Bitboard own, Bitboard opp, Player player) : own_(own), opp_(opp), player_(player) {}
+
+    Cell at(size_t x, size_t y) const {
+        assert(x < N && y < N);
+        const Bitboard bit = squareBit(x + y * N);
+        if (getDiscs(Player::BLACK) & bit) {
+            return Cell::BLACK;
+        } else if (getDiscs(Player::WHITE) & bit) {
+            return Cell::WHITE;
+        } else {
+            return Cell::EMPTY;
+        }
     }
 
-    virtual ~Board() = default;
+    bool isFilled() const {
+        return (own_ | opp_) == Geometry::ALL_SQUARES;
+    }
 
-    Cell& at(size_t x, size_t y) {
-        return cells_.at(x + y * BOARD_SIZE);
+    size_t getNumEmpties() const {
+        return Geometry::CELLS - popCount(own_ | opp_);
     }
 
-    Cell at(size_t x, size_t y) const {
-        return cells_.at(x + y * BOARD_SIZE);
+    bool isGameOver() const {
+        if (isFilled() || getLegalMoves()) {
+            return isFilled();
+        }
+        BasicBoard next = *this;
+        next.pass();
+        return !next.getLegalMoves();
     }
 
-    bool isFilled() const {
-        return std::all_of(cells_.begin(), cells_.end(), [](const Cell cell) {
-            return cell != Cell::EMPTY;
-        });
+    // Depends on the discs from the mover's point of view only, which is all
+    // the position values in this program depend on.
+    uint64_t hash() const {
+        uint64_t h = foldBits(own_) ^ (foldBits(opp_) * 0x9e3779b97f4a7c15ULL);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
     }
 
-    float getBlackOccupation() const {
-        size_t black = 0;
-        for (const auto& cell : cells_) {
-            if (cell == Cell::BLACK) {
-                ++black;
-            }
-        }
-        return static_cast<float>(black) / BOARD_CELLS;
+    bool operator==(const BasicBoard& other) const {
+        return own_ == other.own_ && opp_ == other.opp_ && player_ == other.player_;
     }
 
-    void flipPlayer() {
-        for (auto& cell : cells_) {
-            switch (cell) {
-            case Cell::BLACK:
-                cell = Cell::WHITE;
-                break;
-            case Cell::WHITE:
-                cell = Cell::BLACK;
-                break;
-            default:
-                break;
-            }
-        }
+    Player getPlayer() const {
+        return player_;
     }
 
-    std::vector<Board> getNextStates() const {
-        std::vector<Board> boards;
-        boards.reserve(BOARD_CELLS);
-        Board tmp = *this;
-        for (size_t y = 0; y < BOARD_SIZE; ++y) {
-            for (size_t x = 0; x < BOARD_SIZE; ++x) {
-                if (tmp.put(x, y)) {
-                    boards.push_back(tmp);
-                    boards.back().flipPlayer();
-                }
-                tmp = *this;
+    Bitboard getDiscs(Player player) const {
+        return (player == player_) ? own_ : opp_;
+    }
+
+    float getOccupation(Player player) const {
+        return static_cast<float>(popCount(getDiscs(player))) / Geometry::CELLS;
+    }
+
+    Bitboard getLegalMoves() const {
+        const Bitboard empty = ~(own_ | opp_);
+        Bitboard moves = 0;
+        for (size_t dir = 0; dir < NUM_DIRECTIONS; ++dir) {
+            Bitboard run = shift(own_, dir) & opp_;
+            for (size_t i = 2; i < N - 1; ++i) {
+                run |= shift(run, dir) & opp_;
             }
+            moves |= shift(run, dir) & empty;
         }
-        boards.shrink_to_fit();
-        return boards;
+        return moves;
     }
 
-    Board flipped() const {
-        Board board = *this;
-        board.flipPlayer();
-        return board;
+    void play(size_t square) {
+        const Bitboard bit = squareBit(square);
+        assert(!((own_ | opp_) & bit));
+        applyFlips(bit, getFlips(square));
+        pass();
+    }
+
+    void pass() {
+        std::swap(own_, opp_);
+        player_ = opponent(player_);
     }
 
     bool put(size_t x, size_t y) {
-        if (!isInBound(x, y) || at(x, y) != Cell::EMPTY) {
+        if (x >= N || y >= N) {
             return false;
         }
-
-        at(x, y) = Cell::BLACK;
-
-        bool valid = false;
-        for (int dx = -1; dx <= 1; ++dx) {
-            for (int dy = -1; dy <= 1; ++dy) {
-                if (dx == 0 && dy == 0) {
-                    continue;
-                }
-
-                size_t n = 1;
-                bool blackFound = false;
-                for (; isInBound(x, y, n * dx, n * dy); ++n) {
-                    Cell state = at(x + n * dx, y + n * dy);
-                    if (state == Cell::BLACK) {
-                        blackFound = true;
-                    }
-                    if (state != Cell::WHITE) {
-                        break;
-                    }
-                }
-                if (blackFound && n > 1) {
-                    valid = true;
-                    for (size_t i = 1; i < n; ++i) {
-                        at(x + i * dx, y + i * dy) = Cell::BLACK;
-                    }
-                }
-            }
+        const size_t square = x + y * N;
+        const Bitboard bit = squareBit(square);
+        if ((own_ | opp_) & bit) {
+            return false;
+        }
+        const Bitboard flips = getFlips(square);
+        if (!flips) {
+            return false;
         }
+        applyFlips(bit, flips);
+        pass();
+        return true;
+    }
 
-        return valid;
+    // Four discs in the centre, as in the usual 8x8 start position.
+    static std::string getInitialBoard() {
+        std::string str(Geometry::CELLS, '.');
+        const size_t centre = (N / 2 - 1) * (N + 1);
+        str[centre] = str[centre + N + 1] = 'O';
+        str[centre + 1] = str[centre + N] = 'X';
+        return str;
     }
 
     void print() const {
         std::cout << "  ";
-        for (size_t x = 0; x < BOARD_SIZE; ++x) {
+        for (size_t x = 0; x < N; ++x) {
             std::cout << static_cast<char>(x + 'a');
         }
-        std::cout << std::endl << " +";
-        for (size_t x = 0; x < BOARD_SIZE; ++x) {
+        std::cout << "\n +";
+        for (size_t x = 0; x < N; ++x) {
             std::cout << '-';
         }
-        std::cout << std::endl;
-        for (size_t y = 0; y < BOARD_SIZE; ++y) {
+        std::cout << '\n';
+        for (size_t y = 0; y < N; ++y) {
             std::cout << y + 1 << '|';
-            for (size_t x = 0; x < BOARD_SIZE; ++x) {
+            for (size_t x = 0; x < N; ++x) {
                 std::cout << typeToChar(at(x, y));
             }
-            std::cout << std::endl;
+            std::cout << '\n';
         }
     }
 
 private:
-    std::array<Cell, BOARD_CELLS> cells_;
+    Bitboard own_;
+    Bitboard opp_;
+    Player player_;
 
-    static bool isInBound(size_t x, size_t y, int dx = 0, int dy = 0) {
-        if (dx < 0 && static_cast<size_t>(-dx) > x) {
-            return false;
+    static Bitboard squareBit(size_t idx) {
+        return static_cast<Bitboard>(1) << idx;
+    }
+
+    static Bitboard shift(Bitboard bits, size_t dir) {
+        const int amount = Geometry::DIRECTION_SHIFTS[dir];
+        if (amount > 0) {
+            return (bits << amount) & Geometry::DIRECTION_MASKS[dir];
+        } else {
+            return (bits >> -amount) & Geometry::DIRECTION_MASKS[dir];
         }
-        if (dy < 0 && static_cast<size_t>(-dy) > y) {
-            return false;
+    }
+
+    // Along each ray the first square that is not an opponent disc ends the
+    // run; the discs before it flip if it is one of ours. The first four
+    // directions run towards higher squares, so that square is the lowest
+    // one on the ray, otherwise it is the highest.
+    Bitboard getFlips(size_t square) const {
+        const RayTable<N>& table = RAYS<N>;
+        Bitboard flips = 0;
+        for (unsigned dirs = table.directions[square]; dirs; dirs &= dirs - 1) {
+            const size_t dir = __builtin_ctz(dirs);
+            const Bitboard ray = table.rays[square][dir];
+            const Bitboard stops = ray & ~opp_;
+            if (!stops) {
+                continue;
+            }
+            if (dir < NUM_DIRECTIONS / 2) {
+                const Bitboard stop = stops & -stops;
+                if (stop & own_) {
+                    flips |= ray & (stop - 1);
+                }
+            } else {
+                const Bitboard stop = squareBit(highestSquare(stops));
+                if (stop & own_) {
+                    flips |= ray & ~(stop | (stop - 1));
+                }
+            }
         }
-        return (x + dx < BOARD_SIZE) && (y + dy < BOARD_SIZE);
+        return flips;
+    }
+
+    void applyFlips(Bitboard bit, Bitboard flips) {
+        own_ |= bit | flips;
+        opp_ &= ~flips;
     }
 };
 
-class RNG {
+typedef BasicBoard<BOARD_SIZE> Board;
+
+class SplitMix64 {
 public:
-    RNG() {
-        std::random_device rnd;
-        engine = std::mt19937(rnd());
+    explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+    uint64_t operator()() {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
     }
 
-    virtual ~RNG() = default;
+private:
+    uint64_t state_;
+};
 
-    static RNG& getSingleton() {
-        static RNG instance;
-        return instance;
-    }
+// xoshiro256** by Blackman and Vigna.
+class Xoshiro256 {
+public:
+    typedef uint64_t result_type;
 
-    size_t randomIndex(size_t n) {
-        assert(n > 0);
-        if (n == 1) {
-            return 0;
-        } else {
-            std::uniform_int_distribution<size_t> dist(0, n - 1);
-            return dist(engine);
+    explicit Xoshiro256(uint64_t seed) {
+        SplitMix64 init(seed);
+        for (auto& s : state_) {
+            s = init();
         }
     }
 
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return ~static_cast<result_type>(0);
+    }
+
+    uint64_t operator()() {
+        const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+        const uint64_t t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+        return result;
+    }
+
 private:
-    std::mt19937 engine;
+    std::array<uint64_t, 4> state_;
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
 };
 
-class Node {
+// One engine per thread. Every instance takes the next value of a shared
+// counter as its seed, so a fixed --seed makes single-threaded runs repeatable.
+template<typename Engine>
+class BasicRNG {
 public:
-    Node(const Board& board, Player player, Node* parent) :
-        board_(board),
-        player_(player),
-        isPassMove_(false),
-        games_(0),
-        mean_(0),
-        parent_(parent) {}
-
-    virtual ~Node() = default;
+    static BasicRNG& getSingleton() {
+        static thread_local BasicRNG instance;
+        return instance;
+    }
 
-    bool isLeafNode() const {
-        return children_.empty()
-            || board_.isFilled()
-            || (parent_ && isPassMove_ && parent_->isPassMove_);
+    static void setSeed(uint64_t seed) {
+        seedCounter().store(seed);
+        getSingleton().engine_ = Engine(seedCounter().fetch_add(1));
     }
 
-    void playout() {
-        Board current = board_;
-        Player player = player_;
-        bool passed = isPassMove_;
-        while (!current.isFilled()) {
-            const auto& boards = current.getNextStates();
-            if (boards.empty()) {
-                if (passed) {
-                    break;
-                }
-                passed = true;
-                current = current.flipped();
-            } else {
-                passed = false;
-                const size_t idx = RNG::getSingleton().randomIndex(boards.size());
-                current = boards.at(idx);
+    // Lemire's multiply-and-reject method: unbiased, and almost never divides.
+    size_t randomIndex(size_t n) {
+        assert(n > 0 && n <= UINT32_MAX);
+        const uint32_t range = static_cast<uint32_t>(n);
+        uint64_t m = static_cast<uint64_t>(next32()) * range;
+        uint32_t low = static_cast<uint32_t>(m);
+        if (low < range) {
+            const uint32_t threshold = -range % range;
+            while (low < threshold) {
+                m = static_cast<uint64_t>(next32()) * range;
+                low = static_cast<uint32_t>(m);
             }
-            player = (player == Player::BLACK) ? Player::WHITE : Player::BLACK;
-        }
-
-        const float occ = current.getBlackOccupation();
-        if (player == player_) {
-            propagateResult(1 - occ);
-        } else {
-            propagateResult(occ);
         }
+        return m >> 32;
     }
 
-    void expand() {
-        if (isPassMove_) {
-            assert(parent_);
-            if (parent_->isPassMove_) {
-                return;
-            }
-        }
-        if (children_.empty() && games_ >= MIN_VISITS_TO_EXPAND) {
-            const auto nextPlayer = (player_ == Player::BLACK) ? Player::WHITE : Player::BLACK;
-            const auto& boards = board_.getNextStates();
-            isPassMove_ = boards.empty();
-            if (isPassMove_) {
-                assert(parent_);
-                if (!parent_->isPassMove_) {
-                    children_.emplace_back(std::make_shared<Node>(board_.flipped(), nextPlayer, this));
-                }
-            } else {
-                for (const auto& board : boards) {
-                    children_.emplace_back(std::make_shared<Node>(board, nextPlayer, this));
-                }
-            }
-        }
+    size_t randomSquare(Bitboard bits) {
+        return nthSquare(bits, randomIndex(popCount(bits)));
     }
 
-    std::weak_ptr<Node> getChildWithMaxUCB() const {
-        return getChildWithMaxValue<float>([](const std::shared_ptr<Node> child) {
-            return child->calcUCB();
-        });
+private:
+    Engine engine_;
+
+    BasicRNG() : engine_(seedCounter().fetch_add(1)) {}
+
+    static std::atomic<uint64_t>& seedCounter() {
+        static std::atomic<uint64_t> counter(randomSeed());
+        return counter;
     }
 
-    std::weak_ptr<Node> getChildWithMaxVisits() const {
-        return getChildWithMaxValue<size_t>([](const std::shared_ptr<Node> child) {
-            return child->games_;
-        });
+    static uint64_t randomSeed() {
+        std::random_device rnd;
+        return (static_cast<uint64_t>(rnd()) << 32) ^ rnd();
     }
 
-    const Board& getBoard() const {
-        return board_;
+    uint32_t next32() {
+        return static_cast<uint32_t>(engine_() >> 32);
     }
+};
 
-    size_t getNumGames() const {
-        return games_;
+typedef BasicRNG<Xoshiro256> RNG;
+
+typedef std::chrono::steady_clock Clock;
+
+// Looking at the clock every iteration is wasted work once playouts are
+// cheap, so each thread only checks after a fixed amount of work. Callers
+// that do more than one playout per call say how many with `work`, so that
+// batches and multiple playouts per leaf do not stretch the interval.
+// A search can also be called off early through `stop`, which is looked at
+// just as rarely.
+class Deadline {
+public:
+    explicit Deadline(Clock::time_point time, const std::atomic<bool>* stop = nullptr) :
+        time_(time), stop_(stop), iterations_(0) {}
+
+    static Deadline after(float seconds, const std::atomic<bool>* stop = nullptr) {
+        return Deadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds)), stop);
     }
 
-    float getExpectedOccupation() const {
-        return 1 - mean_;
+    bool reached(size_t work = 1) {
+        iterations_ += work;
+        if (iterations_ < CHECK_INTERVAL) {
+            return false;
+        }
+        iterations_ = 0;
+        return (stop_ && stop_->load(std::memory_order_relaxed)) || Clock::now() >= time_;
     }
 
 private:
-    Board board_;
-    Player player_;
-    bool isPassMove_;
-    size_t games_;
-    float mean_;
+    static const size_t CHECK_INTERVAL = 64;
 
-    Node* parent_;
-    std::vector<std::shared_ptr<Node>> children_;
+    Clock::time_point time_;
+    const std::atomic<bool>* stop_;
+    size_t iterations_;
+};
 
-    float calcUCB() const {
-        assert(parent_);
-        assert(games_ <= parent_->games_);
+// Counters for the hot paths of the search, compiled in with -DSEARCH_STATS
+// (make STATS=1). Each thread counts into its own copy, which is added to
+// the totals when the thread is done searching.
+#ifdef SEARCH_STATS
+#define STATS(statement) statement
 
-        if (games_ == 0) {
-            return INFINITY;
-        } else {
-            float bias = EXPLORATION_CONST * sqrtf(logf(parent_->games_) / games_);
-            return mean_ + bias;
+struct SearchStats {
+    enum Phase {
+        SELECTION, EXPANSION, PLAYOUT, BACKUP, NUM_PHASES
+    };
+
+    uint64_t phaseNanos[NUM_PHASES] = {};
+    uint64_t descents = 0;
+    uint64_t depthSum = 0;
+    uint64_t maxDepth = 0;
+    uint64_t expansions = 0;
+    uint64_t edgesAllocated = 0;
+    uint64_t nodesAllocated = 0;
+    uint64_t playouts = 0;
+    uint64_t playoutPlies = 0;
+
+    static SearchStats& local() {
+        static thread_local SearchStats stats;
+        return stats;
+    }
+
+    // Adds this thread's counts to the totals and starts over.
+    static void collect() {
+        SearchStats& mine = local();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < NUM_PHASES; ++i) {
+            totals_.phaseNanos[i] += mine.phaseNanos[i];
         }
+        totals_.descents += mine.descents;
+        totals_.depthSum += mine.depthSum;
+        totals_.maxDepth = std::max(totals_.maxDepth, mine.maxDepth);
+        totals_.expansions += mine.expansions;
+        totals_.edgesAllocated += mine.edgesAllocated;
+        totals_.nodesAllocated += mine.nodesAllocated;
+        totals_.playouts += mine.playouts;
+        totals_.playoutPlies += mine.playoutPlies;
+        mine = SearchStats();
     }
 
-    void propagateResult(float occ) {
-        mean_ = (games_ * mean_ + occ) / (games_ + 1);
-        ++games_;
-        if (parent_) {
-            parent_->propagateResult(1 - occ);
+    // Phase times are summed over all threads.
+    static void dump(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const SearchStats& t = totals_;
+        const char* const names[NUM_PHASES] = {"selection", "expansion", "playout", "backup"};
+        out << "#phases:";
+        for (size_t i = 0; i < NUM_PHASES; ++i) {
+            out << (i ? ", " : " ") << names[i] << " " << t.phaseNanos[i] * 1e-9 << "s";
         }
+        out << "\n#tree: descents " << t.descents
+            << ", depth avg " << static_cast<double>(t.depthSum) / std::max<uint64_t>(t.descents, 1)
+            << " max " << t.maxDepth
+            << ", expansions " << t.expansions
+            << ", branching " << static_cast<double>(t.edgesAllocated) / std::max<uint64_t>(t.expansions, 1)
+            << ", nodes allocated " << t.nodesAllocated
+            << ", edges allocated " << t.edgesAllocated
+            << "\n#playouts: " << t.playouts
+            << ", plies avg " << static_cast<double>(t.playoutPlies) / std::max<uint64_t>(t.playouts, 1)
+            << std::endl;
+        totals_ = SearchStats();
     }
 
-    template<typename T>
-    std::weak_ptr<Node> getChildWithMaxValue(std::function<T(std::shared_ptr<Node>)> eval) const {
-        assert(!children_.empty());
+private:
+    static std::mutex mutex_;
+    static SearchStats totals_;
+};
 
-        std::vector<T> values;
-        values.reserve(children_.size());
-        std::transform(children_.begin(), children_.end(), std::back_inserter(values), [&eval] (std::weak_ptr<Node> child) {
-            const std::shared_ptr<Node> c = child.lock();
-            assert(c);
-            return eval(c);
-        });
-        const size_t i = std::distance(values.begin(), std::max_element(values.begin(), values.end()));
+std::mutex SearchStats::mutex_;
+SearchStats SearchStats::totals_;
 
-        return children_.at(i);
+class PhaseTimer {
+public:
+    explicit PhaseTimer(SearchStats::Phase phase) : phase_(phase), start_(Clock::now()) {}
+
+    ~PhaseTimer() {
+        SearchStats::local().phaseNanos[phase_] += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
     }
+
+private:
+    SearchStats::Phase phase_;
+    Clock::time_point start_;
 };
+#else
+#define STATS(statement)
+#endif
 
-Board searchMove(const Board& board, float time_sec) {
-    const auto& boards = board.getNextStates();
-    switch (boards.size()) {
-    case 0:
-        return board.flipped();
-    case 1:
-        return boards.front();
-    default:
-        break;
+// Exact negamax search for the last few empties. Scores are final disc
+// differences from the point of view of the side to move.
+class EndgameSolver {
+public:
+    EndgameSolver() : deadline_(nullptr), aborted_(false), nodes_(0) {}
+
+    // Fills in the best move and its exact score, unless the deadline
+    // passes first.
+    bool solve(const Board& board, Deadline& deadline, size_t& bestMove, int& score) {
+        deadline_ = &deadline;
+        aborted_ = false;
+        nodes_ = 0;
+        if (table_.empty()) {
+            table_.resize(TABLE_SIZE);
+        }
+        score = search(board, -static_cast<int>(BOARD_CELLS), BOARD_CELLS, false, &bestMove);
+        deadline_ = nullptr;
+        return !aborted_;
     }
 
-    const auto root = std::make_shared<Node>(board, Player::BLACK, nullptr);
-    root->expand();
+    int solve(const Board& board) {
+        aborted_ = false;
+        nodes_ = 0;
+        return search(board, -static_cast<int>(BOARD_CELLS), BOARD_CELLS, false, nullptr);
+    }
 
-    const auto start = clock();
-    while (clock() - start < time_sec * CLOCKS_PER_SEC) {
-        std::weak_ptr<Node> current = root;
-        while (true) {
-            auto c = current.lock();
-            assert(c);
+    size_t getNumNodes() const {
+        return nodes_;
+    }
 
-            if (c->isLeafNode()) {
-                c->playout();
-                c->expand();
-                break;
-            } else {
-                current = c->getChildWithMaxUCB();
+private:
+    struct Entry {
+        Bitboard own = 0;
+        Bitboard opp = 0;
+        int8_t lower = 0;
+        int8_t upper = 0;
+        uint8_t bestMove = 0;
+    };
+
+    static const size_t TABLE_SIZE = 1 << 20;
+    static const size_t TABLE_MIN_EMPTIES = 8;
+    static const size_t SORT_MIN_EMPTIES = 7;
+    // There can be no more moves than empty squares, whatever the solver
+    // is asked to take on.
+    static const size_t MAX_MOVES = BOARD_CELLS;
+
+    std::vector<Entry> table_;
+    Deadline* deadline_;
+    bool aborted_;
+    size_t nodes_;
+
+    static Bitboard oddQuadrants(const Board& board) {
+        static constexpr Bitboard QUADRANTS[] = {
+            Geometry::quadrant(0), Geometry::quadrant(1), Geometry::quadrant(2), Geometry::quadrant(3)
+        };
+        const Bitboard empty = ~(board.getDiscs(Player::BLACK) | board.getDiscs(Player::WHITE));
+        Bitboard odd = 0;
+        for (const Bitboard quadrant : QUADRANTS) {
+            if (popCount(empty & quadrant) & 1) {
+                odd |= quadrant;
             }
         }
+        return odd;
     }
 
-    std::cout << "#games: " << root->getNumGames() << ", occupation: " << root->getExpectedOccupation() << std::endl;
+    static int finalScore(const Board& board) {
+        const Player player = board.getPlayer();
+        return static_cast<int>(popCount(board.getDiscs(player))) - static_cast<int>(popCount(board.getDiscs(opponent(player))));
+    }
 
-    const auto c = root->getChildWithMaxVisits().lock();
-    assert(c);
-    return c->getBoard();
-}
+    // Near the leaves only the cheap parity order is used. Higher up, moves
+    // are sorted fastest-first (fewest replies for the opponent), with parity
+    // breaking ties and the table's best move tried first.
+    size_t orderMoves(const Board& board, Bitboard moves, size_t hint, size_t* order) const {
+        const Bitboard odd = oddQuadrants(board);
+        size_t n = 0;
+        if (board.getNumEmpties() < SORT_MIN_EMPTIES) {
+            for (Bitboard rest = moves & odd; rest; rest &= rest - 1) {
+                order[n++] = lowestSquare(rest);
+            }
+            for (Bitboard rest = moves & ~odd; rest; rest &= rest - 1) {
+                order[n++] = lowestSquare(rest);
+            }
+            return n;
+        }
 
-int main(int argc, char** argv) {
-    float time = 1;
-    if (argc >= 2) {
-        time = atof(argv[1]);
+        int keys[MAX_MOVES];
+        for (Bitboard rest = moves; rest; rest &= rest - 1) {
+            const size_t square = lowestSquare(rest);
+            Board next = board;
+            next.play(square);
+            int key = 2 * static_cast<int>(popCount(next.getLegalMoves()));
+            if (!(odd & (static_cast<Bitboard>(1) << square))) {
+                ++key;
+            }
+            if (square == hint) {
+                key = -1;
+            }
+            size_t i = n++;
+            for (; i > 0 && keys[i - 1] > key; --i) {
+                keys[i] = keys[i - 1];
+                order[i] = order[i - 1];
+            }
+            keys[i] = key;
+            order[i] = square;
+        }
+        return n;
     }
 
-    Board current;
-    current.print();
+    int search(const Board& board, int alpha, int beta, bool passed, size_t* bestMove) {
+        ++nodes_;
+        if (deadline_ && deadline_->reached()) {
+            aborted_ = true;
+        }
+        if (aborted_) {
+            return 0;
+        }
 
-    char str[2];
-    while (!current.isFilled()) {
-        while (true) {
-            std::cout << "move? ";
-            std::cin >> str;
-            const size_t x = tolower(str[0]) - 'a';
-            const size_t y = str[1] - '1';
-            if (current.put(x, y)) {
-                break;
+        const Bitboard moves = board.getLegalMoves();
+        if (!moves) {
+            if (passed) {
+                return finalScore(board);
             }
+            Board next = board;
+            next.pass();
+            return -search(next, -beta, -alpha, true, nullptr);
+        }
+
+        Entry* entry = nullptr;
+        size_t hint = BOARD_CELLS;
+        if (!table_.empty() && board.getNumEmpties() >= TABLE_MIN_EMPTIES) {
+            entry = &table_[board.hash() & (TABLE_SIZE - 1)];
+            const Board stored(entry->own, entry->opp, board.getPlayer());
+            if (stored == board) {
+                hint = entry->bestMove;
+                if (!bestMove) {
+                    if (entry->lower >= beta) {
+                        return entry->lower;
+                    }
+                    if (entry->upper <= alpha) {
+                        return entry->upper;
+                    }
+                    alpha = std::max<int>(alpha, entry->lower);
+                    beta = std::min<int>(beta, entry->upper);
+                    if (alpha >= beta) {
+                        return alpha;
+                    }
+                }
+            }
+        }
+
+        const int alphaOrig = alpha;
+        size_t order[MAX_MOVES];
+        const size_t n = orderMoves(board, moves, hint, order);
+        int best = -static_cast<int>(BOARD_CELLS) - 1;
+        size_t bestSquare = BOARD_CELLS;
+        for (size_t i = 0; i < n; ++i) {
+            Board next = board;
+            next.play(order[i]);
+            const int score = -search(next, -beta, -alpha, false, nullptr);
+            if (score > best) {
+                best = score;
+                bestSquare = order[i];
+                if (score > alpha) {
+                    alpha = score;
+                    if (alpha >= beta) {
+                        break;
+                    }
+                }
+            }
+        }
+        if (aborted_) {
+            return 0;
+        }
+
+        if (entry) {
+            const Player player = board.getPlayer();
+            entry->own = board.getDiscs(player);
+            entry->opp = board.getDiscs(opponent(player));
+            entry->lower = (best > alphaOrig) ? best : -static_cast<int>(BOARD_CELLS);
+            entry->upper = (best < beta) ? best : BOARD_CELLS;
+            entry->bestMove = bestSquare;
+        }
+        if (bestMove) {
+            *bestMove = bestSquare;
+        }
+        return best;
+    }
+};
+
+// Results are summed in fixed point instead of being kept as running means,
+// so backing one up is a plain atomic add and the sums never drift.
+const double RESULT_SCALE = 1 << 16;
+
+inline void addResults(std::atomic<uint32_t>& games, std::atomic<uint64_t>& sum, uint32_t count, float total) {
+    games.fetch_add(count, std::memory_order_relaxed);
+    sum.fetch_add(static_cast<uint64_t>(total * RESULT_SCALE + 0.5), std::memory_order_relaxed);
+}
+
+inline float getMeanResult(const std::atomic<uint32_t>& games, const std::atomic<uint64_t>& sum) {
+    const uint32_t played = games.load(std::memory_order_relaxed);
+    return played ? sum.load(std::memory_order_relaxed) / (RESULT_SCALE * played) : 0;
+}
+
+// Statistics shared by every tree node that reaches the same position, so
+// transpositions pool their playouts. Entries are tagged with the full hash;
+// a node whose slot has been taken over by another position quietly falls
+// back to its own statistics. Races between threads only ever mix up
+// statistics, never memory.
+class NodeTable {
+public:
+    enum class Replacement {
+        ALWAYS, VISITS
+    };
+
+    struct Entry {
+        std::atomic<uint64_t> key;
+        std::atomic<uint32_t> games;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint32_t> generation;
+    };
+
+    NodeTable() : megabytes_(0), mask_(0), replacement_(Replacement::ALWAYS), generation_(0) {}
+
+    void resize(size_t megabytes) {
+        megabytes_ = megabytes;
+        size_t n = 1;
+        while (2 * n * sizeof(Entry) <= (megabytes << 20)) {
+            n *= 2;
+        }
+        entries_.reset(new Entry[n]());
+        mask_ = n - 1;
+    }
+
+    void setReplacement(Replacement replacement) {
+        replacement_ = replacement;
+    }
+
+    // Only records the size, for a table that just serves as a template
+    // for resizeLike().
+    void setSize(size_t megabytes) {
+        megabytes_ = megabytes;
+    }
+
+    // An empty table with the size and the replacement policy of `other`.
+    void resizeLike(const NodeTable& other) {
+        resize(other.megabytes_);
+        replacement_ = other.replacement_;
+    }
+
+    void newSearch() {
+        ++generation_;
+    }
+
+    // With Replacement::VISITS a slot is only handed to a new position if
+    // its resident is left over from an earlier search or has barely been
+    // visited; with ALWAYS the newest position wins.
+    Entry* insert(uint64_t key) {
+        Entry& entry = entries_[key & mask_];
+        const uint64_t resident = entry.key.load(std::memory_order_relaxed);
+        if (resident == key) {
+            entry.generation.store(generation_, std::memory_order_relaxed);
+            return &entry;
+        }
+        if (replacement_ == Replacement::VISITS && resident != 0
+                && entry.generation.load(std::memory_order_relaxed) == generation_
+                && entry.games.load(std::memory_order_relaxed) >= VISITS_TO_KEEP) {
+            return nullptr;
+        }
+        entry.games.store(0, std::memory_order_relaxed);
+        entry.sum.store(0, std::memory_order_relaxed);
+        entry.generation.store(generation_, std::memory_order_relaxed);
+        entry.key.store(key, std::memory_order_relaxed);
+        return &entry;
+    }
+
+private:
+    static const uint32_t VISITS_TO_KEEP = 4;
+
+    std::unique_ptr<Entry[]> entries_;
+    size_t megabytes_;
+    size_t mask_;
+    Replacement replacement_;
+    uint32_t generation_;
+};
+
+// Squares are written as a column letter and a row number, e.g. "f5"; a
+// pass is written "--".
+std::string getMoveName(size_t square) {
+    if (square == BOARD_CELLS) {
+        return "--";
+    }
+    return std::string(1, static_cast<char>('a' + square % BOARD_SIZE)) + std::to_string(square / BOARD_SIZE + 1);
+}
+
+// Positions are written as in INITIAL_BOARD, BOARD_CELLS of `X`, `O` and
+// `.` row by row, followed by the side to move.
+std::string getBoardString(const Board& board) {
+    std::string str;
+    for (size_t y = 0; y < BOARD_SIZE; ++y) {
+        for (size_t x = 0; x < BOARD_SIZE; ++x) {
+            str += typeToChar(board.at(x, y));
+        }
+    }
+    return str + (board.getPlayer() == Player::BLACK ? " X" : " O");
+}
+
+bool parseBoardString(const std::string& cells, const std::string& player, Board& board) {
+    if (cells.size() != BOARD_CELLS || cells.find_first_not_of("xXoO.") != std::string::npos
+            || player.size() != 1 || std::string("xXoO").find(player[0]) == std::string::npos) {
+        return false;
+    }
+    board = Board(cells, (tolower(player[0]) == 'x') ? Player::BLACK : Player::WHITE);
+    return true;
+}
+
+// Replays a run of move names such as "f5d6c3" from `board`, so that
+// `squares` ends up with one square per ply (BOARD_CELLS for a pass).
+// Stops at the first name that is not a legal move.
+bool parseMoves(const std::string& str, Board board, std::vector<size_t>& squares) {
+    squares.clear();
+    size_t pos = 0;
+    while (pos < str.size()) {
+        if (str.compare(pos, 2, "--") == 0) {
+            if (board.getLegalMoves()) {
+                return false;
+            }
+            board.pass();
+            squares.push_back(BOARD_CELLS);
+            pos += 2;
+            continue;
+        }
+        const size_t x = tolower(str[pos]) - 'a';
+        size_t end = pos + 1;
+        while (end < str.size() && isdigit(str[end])) {
+            ++end;
+        }
+        const size_t y = atoi(str.substr(pos + 1, end - pos - 1).c_str()) - 1;
+        if (end == pos + 1 || !board.put(x, y)) {
+            return false;
+        }
+        squares.push_back(x + y * BOARD_SIZE);
+        pos = end;
+    }
+    return true;
+}
+
+// An opening book is a file of fixed-size records sorted by position hash,
+// mapped straight into memory so that loading it costs nothing. Every move
+// seen in a position has its own record, with the number of games it was
+// played in and the mean final occupation of the player who made it.
+class OpeningBook {
+public:
+    struct Entry {
+        uint64_t key;
+        uint32_t games;
+        float score;
+        uint8_t move;
+        uint8_t padding[7];
+    };
+    static_assert(sizeof(Entry) == 24, "the record layout is part of the file format");
+
+    struct Header {
+        char magic[8];
+        uint32_t boardSize;
+        uint32_t reserved;
+        uint64_t numEntries;
+    };
+
+    OpeningBook() : data_(nullptr), size_(0), entries_(nullptr), numEntries_(0) {}
+
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    ~OpeningBook() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    bool open(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        // The record count is checked by division, as a product could overflow.
+        const Header* header = static_cast<const Header*>(data);
+        const size_t recordBytes = info.st_size - sizeof(Header);
+        if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 || header->boardSize != BOARD_SIZE
+                || recordBytes % sizeof(Entry) != 0 || header->numEntries != recordBytes / sizeof(Entry)) {
+            munmap(data, info.st_size);
+            return false;
+        }
+        data_ = data;
+        size_ = info.st_size;
+        entries_ = reinterpret_cast<const Entry*>(header + 1);
+        numEntries_ = header->numEntries;
+        return true;
+    }
+
+    // Returns the most played legal move of `board`, if it has been played
+    // in at least `minGames` games.
+    bool lookup(const Board& board, size_t minGames, size_t& move, const Entry*& found) const {
+        const uint64_t key = board.hash();
+        const Entry* first = std::lower_bound(entries_, entries_ + numEntries_, key, [](const Entry& entry, uint64_t k) {
+            return entry.key < k;
+        });
+        const Bitboard moves = board.getLegalMoves();
+        found = nullptr;
+        for (const Entry* entry = first; entry < entries_ + numEntries_ && entry->key == key; ++entry) {
+            const bool legal = (entry->move == BOARD_CELLS) ? !moves
+                : (entry->move < BOARD_CELLS && (moves & (static_cast<Bitboard>(1) << entry->move)));
+            if (legal && entry->games >= minGames && (!found || entry->games > found->games)) {
+                found = entry;
+            }
+        }
+        if (found) {
+            move = found->move;
+        }
+        return found;
+    }
+
+    // Reads finished games from a self-play log, one record per line in
+    // the form "game moves=f5d6c3... result=12 ..." where the result is the
+    // final disc difference for black, and writes a book of the first
+    // `plies` moves of every game.
+    static bool build(std::istream& log, const std::string& path, size_t plies) {
+        std::vector<Entry> entries;
+        std::vector<size_t> squares;
+        std::string line;
+        while (std::getline(log, line)) {
+            std::istringstream fields(line);
+            std::string field, moves;
+            bool hasResult = false;
+            int result = 0;
+            fields >> field;
+            if (field != "game") {
+                continue;
+            }
+            while (fields >> field) {
+                if (field.compare(0, 6, "moves=") == 0) {
+                    moves = field.substr(6);
+                } else if (field.compare(0, 7, "result=") == 0) {
+                    result = atoi(field.c_str() + 7);
+                    hasResult = true;
+                }
+            }
+            if (!hasResult || !parseMoves(moves, Board(), squares)) {
+                continue;
+            }
+            Board board;
+            for (size_t i = 0; i < squares.size() && i < plies; ++i) {
+                const int diff = (board.getPlayer() == Player::BLACK) ? result : -result;
+                Entry entry = Entry();
+                entry.key = board.hash();
+                entry.games = 1;
+                entry.score = static_cast<float>(static_cast<int>(BOARD_CELLS) + diff) / (2 * BOARD_CELLS);
+                entry.move = squares[i];
+                entries.push_back(entry);
+                if (squares[i] == BOARD_CELLS) {
+                    board.pass();
+                } else {
+                    board.play(squares[i]);
+                }
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.key < b.key || (a.key == b.key && a.move < b.move);
+        });
+        std::vector<Entry> merged;
+        for (const Entry& entry : entries) {
+            if (!merged.empty() && merged.back().key == entry.key && merged.back().move == entry.move) {
+                Entry& last = merged.back();
+                last.score += (entry.score - last.score) / ++last.games;
+            } else {
+                merged.push_back(entry);
+            }
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        Header header = Header();
+        memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.boardSize = BOARD_SIZE;
+        header.numEntries = merged.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(merged.data()), merged.size() * sizeof(Entry));
+        return static_cast<bool>(out);
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'M', 'C', 'R', 'B', 'O', 'O', 'K', '1'};
+
+    void* data_;
+    size_t size_;
+    const Entry* entries_;
+    size_t numEntries_;
+};
+
+constexpr char OpeningBook::MAGIC[8];
+
+enum class ParallelMode {
+    TREE, ROOT
+};
+
+enum class PlayoutPolicy {
+    UNIFORM, HEURISTIC
+};
+
+const PlayoutPolicy PLAYOUT_POLICIES[] = {
+    PlayoutPolicy::UNIFORM, PlayoutPolicy::HEURISTIC
+};
+
+const char* getPolicyName(PlayoutPolicy policy) {
+    return (policy == PlayoutPolicy::HEURISTIC) ? "heuristic" : "uniform";
+}
+
+class Node;
+struct NodePool;
+
+// Gets a look at the tree every `SearchConfig::infoInterval` seconds while
+// a shared-tree search runs.
+class SearchObserver {
+public:
+    virtual ~SearchObserver() {}
+
+    virtual void onProgress(Node& root, NodePool& pool, float elapsedSec) = 0;
+};
+
+struct SearchConfig {
+    float timeSec = 1;
+    size_t threads = 1;
+    ParallelMode parallel = ParallelMode::TREE;
+    size_t endgameEmpties = 14;
+    size_t exactLeafEmpties = 0;
+    NodeTable* table = nullptr;
+    size_t expandThreshold = MIN_VISITS_TO_EXPAND;
+    size_t maxNodes = 0;
+    size_t maxMemory = 0;
+    size_t batchSize = 1;
+    size_t playoutsPerLeaf = 1;
+    float exploration = EXPLORATION_CONST;
+    PlayoutPolicy policy = PlayoutPolicy::HEURISTIC;
+    size_t playoutCutoff = 0;
+    const OpeningBook* book = nullptr;
+    size_t bookMinGames = 2;
+    bool verbose = true;
+    const std::atomic<bool>* stop = nullptr;
+    SearchObserver* observer = nullptr;
+    float infoInterval = 0.5f;
+};
+
+// Hands out index ranges over fixed-size blocks that are never moved, so
+// that indices stay valid while other threads allocate. `Block` says how
+// the SIZE items of a block are laid out.
+template<typename Block>
+class BlockArena {
+public:
+    static const size_t NO_INDEX = SIZE_MAX;
+
+    BlockArena() : blocks_(MAX_BLOCKS), numBlocks_(0), size_(0), capacity_(SIZE_MAX) {}
+
+    // A range never straddles two blocks, so it can be walked with a plain
+    // pointer. Only a full block table stops it, which the search never runs
+    // into as it allocates with tryAllocate().
+    size_t allocate(size_t n) {
+        const size_t idx = claim(n, MAX_ITEMS);
+        if (idx == NO_INDEX) {
+            throw std::bad_alloc();
+        }
+        return idx;
+    }
+
+    // Same as allocate(), but gives up with NO_INDEX instead of growing past
+    // the capacity or the block table.
+    size_t tryAllocate(size_t n) {
+        return claim(n, std::min(capacity_, MAX_ITEMS));
+    }
+
+    void setCapacity(size_t capacity) {
+        capacity_ = capacity;
+    }
+
+    // Also full once the last block of the table is being used, so that the
+    // search stops growing the tree a little short of the hard limit.
+    bool isFull() const {
+        const size_t size = size_.load(std::memory_order_relaxed);
+        return size >= capacity_ || size + BLOCK_SIZE > MAX_ITEMS;
+    }
+
+    void reset() {
+        size_.store(0, std::memory_order_relaxed);
+    }
+
+    // Hands the blocks back as well. Only while nobody uses the arena.
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < numBlocks_.load(std::memory_order_relaxed); ++i) {
+            blocks_[i].reset();
+        }
+        numBlocks_.store(0, std::memory_order_relaxed);
+        size_.store(0, std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    // What the arena holds, which is what a memory budget has to count:
+    // blocks are allocated whole and kept across reset().
+    size_t getReservedBytes() const {
+        return numBlocks_.load(std::memory_order_relaxed) * sizeof(Block);
+    }
+
+protected:
+    static const size_t BLOCK_SIZE = Block::SIZE;
+
+    Block& getBlock(size_t idx) const {
+        return *blocks_[idx / BLOCK_SIZE];
+    }
+
+private:
+    static const size_t MAX_BLOCKS = 1 << 12;
+    static const size_t MAX_ITEMS = MAX_BLOCKS * BLOCK_SIZE;
+
+    // Blocks are mapped straight from the system rather than taken from the
+    // heap, so that released blocks really leave the process, and pages an
+    // arena never gets to are never touched.
+    struct BlockDeleter {
+        void operator()(Block* block) const {
+            block->~Block();
+            munmap(block, sizeof(Block));
+        }
+    };
+
+    static Block* newBlock() {
+        void* memory = mmap(nullptr, sizeof(Block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        return new (memory) Block;
+    }
+
+    // Sized up front so that readers never race with the table growing.
+    std::vector<std::unique_ptr<Block, BlockDeleter>> blocks_;
+    std::atomic<size_t> numBlocks_;
+    std::atomic<size_t> size_;
+    size_t capacity_;
+    std::mutex mutex_;
+
+    // Ranges are claimed by moving the size on with a compare-and-swap; the
+    // lock is only taken by the few allocations that need a new block, and
+    // the others wait on it only if their block is still being mapped.
+    size_t claim(size_t n, size_t limit) {
+        assert(n > 0 && n <= BLOCK_SIZE);
+        size_t size = size_.load(std::memory_order_relaxed);
+        size_t idx;
+        do {
+            idx = size;
+            if (idx % BLOCK_SIZE + n > BLOCK_SIZE) {
+                idx += BLOCK_SIZE - idx % BLOCK_SIZE;
+            }
+            if (idx + n > limit) {
+                return NO_INDEX;
+            }
+        } while (!size_.compare_exchange_weak(size, idx + n, std::memory_order_relaxed));
+
+        if (numBlocks_.load(std::memory_order_acquire) * BLOCK_SIZE < idx + n) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (numBlocks_.load(std::memory_order_relaxed) * BLOCK_SIZE < idx + n) {
+                const size_t block = numBlocks_.load(std::memory_order_relaxed);
+                blocks_[block].reset(newBlock());
+                numBlocks_.store(block + 1, std::memory_order_release);
+            }
+        }
+        return idx;
+    }
+};
+
+template<typename T>
+struct ArrayBlock {
+    static const size_t SIZE = 1 << 16;
+
+    T items[SIZE];
+};
+
+template<typename T>
+class Arena : public BlockArena<ArrayBlock<T>> {
+public:
+    T& operator[](size_t idx) {
+        return this->getBlock(idx).items[idx % this->BLOCK_SIZE];
+    }
+
+    const T& operator[](size_t idx) const {
+        return this->getBlock(idx).items[idx % this->BLOCK_SIZE];
+    }
+};
+
+typedef uint32_t NodeIndex;
+
+const size_t PASS_MOVE = BOARD_CELLS;
+
+// The UCB bias c * sqrt(log(N) / n) splits into a parent term c * sqrt(log(N)),
+// computed once per selection step, and 1 / sqrt(n) per child. Both come
+// from tables for the small visit counts that most nodes have.
+class UCBTables {
+public:
+    UCBTables() {
+        sqrtLog_[0] = 0;
+        invSqrt_[0] = 0;
+        for (size_t n = 1; n < SIZE; ++n) {
+            sqrtLog_[n] = sqrtf(logf(n));
+            invSqrt_[n] = 1 / sqrtf(n);
+        }
+    }
+
+    static float getParentTerm(float exploration, size_t parentVisits) {
+        return exploration * ((parentVisits < SIZE) ? tables_.sqrtLog_[parentVisits] : sqrtf(logf(parentVisits)));
+    }
+
+    static float getInvSqrt(uint32_t visits) {
+        return (visits < SIZE) ? tables_.invSqrt_[visits] : 1 / sqrtf(visits);
+    }
+
+private:
+    static const size_t SIZE = 1 << 12;
+    static const UCBTables tables_;
+
+    float sqrtLog_[SIZE];
+    float invSqrt_[SIZE];
+};
+
+const UCBTables UCBTables::tables_;
+
+// The edges of a tree are stored as a struct of arrays: a block holds one
+// array per field, and as the edges of a node never straddle two blocks, a
+// selection step reads the visits, sums and virtual losses of all children
+// from a few packed cache lines instead of touching one line per child.
+struct EdgeBlock {
+    static const size_t SIZE = 1 << 16;
+
+    std::atomic<uint64_t> sum[SIZE];
+    std::atomic<uint32_t> games[SIZE];
+    std::atomic<uint32_t> virtualLoss[SIZE];
+    std::atomic<NodeIndex> child[SIZE];
+    uint8_t move[SIZE];
+};
+
+const size_t EDGE_BYTES = sizeof(EdgeBlock) / EdgeBlock::SIZE;
+
+// One move out of a node, with the statistics of the position it leads to
+// from the point of view of the player making it. The node behind the edge
+// is only built once a descent actually goes through it.
+// An Edge is a handle to one slot of an EdgeBlock and is passed by value;
+// a default-constructed one refers to no edge at all.
+class Edge {
+public:
+    static const NodeIndex NO_CHILD = UINT32_MAX;
+    static const NodeIndex PENDING = UINT32_MAX - 1;
+
+    Edge() : block_(nullptr), slot_(0) {}
+
+    Edge(EdgeBlock& block, size_t slot) : block_(&block), slot_(slot) {}
+
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    // The edge `i` places further along the edges of the same node.
+    Edge offset(size_t i) const {
+        return Edge(*block_, slot_ + i);
+    }
+
+    std::atomic<uint32_t>& games() const {
+        return block_->games[slot_];
+    }
+
+    std::atomic<uint64_t>& sum() const {
+        return block_->sum[slot_];
+    }
+
+    std::atomic<uint32_t>& virtualLoss() const {
+        return block_->virtualLoss[slot_];
+    }
+
+    std::atomic<NodeIndex>& child() const {
+        return block_->child[slot_];
+    }
+
+    size_t getMove() const {
+        return block_->move[slot_];
+    }
+
+    void init(size_t square) const {
+        games().store(0, std::memory_order_relaxed);
+        sum().store(0, std::memory_order_relaxed);
+        virtualLoss().store(0, std::memory_order_relaxed);
+        child().store(NO_CHILD, std::memory_order_relaxed);
+        block_->move[slot_] = square;
+    }
+
+    Board apply(Board board) const {
+        if (getMove() == PASS_MOVE) {
+            board.pass();
+        } else {
+            board.play(getMove());
+        }
+        return board;
+    }
+
+    NodeIndex getChild() const {
+        const NodeIndex idx = child().load(std::memory_order_acquire);
+        return (idx == PENDING) ? NO_CHILD : idx;
+    }
+
+    size_t getNumGames() const {
+        return games().load(std::memory_order_relaxed);
+    }
+
+    float getMean() const {
+        return getMeanResult(games(), sum());
+    }
+
+    void addVirtualLoss() const {
+        virtualLoss().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Pending virtual losses count as visits that scored nothing, which steers
+    // concurrent descents apart. `parentTerm` is the part of the exploration
+    // bias that only depends on the parent, see UCBTables::getParentTerm().
+    float calcUCB(float parentTerm, float valueEstimate) const {
+        const uint32_t played = games().load(std::memory_order_relaxed);
+        const uint32_t visits = played + virtualLoss().load(std::memory_order_relaxed);
+        if (visits == 0) {
+            return INFINITY;
+        } else {
+            const float value = valueEstimate * played / visits;
+            return value + parentTerm * UCBTables::getInvSqrt(visits);
+        }
+    }
+
+private:
+    EdgeBlock* block_;
+    size_t slot_;
+};
+
+class EdgeArena : public BlockArena<EdgeBlock> {
+public:
+    Edge operator[](size_t idx) const {
+        return Edge(getBlock(idx), idx % BLOCK_SIZE);
+    }
+};
+
+struct NodePool;
+
+class Node {
+public:
+    Node() :
+        board_(0, 0, Player::BLACK),
+        isPassMove_(false),
+        state_(UNEXPANDED),
+        key_(0),
+        shared_(nullptr),
+        parent_(nullptr),
+        edge_(),
+        firstEdge_(0),
+        numEdges_(0) {}
+
+    void init(const Board& board, Node* parent, Edge edge, NodeTable* table) {
+        board_ = board;
+        isPassMove_ = false;
+        state_.store(UNEXPANDED, std::memory_order_relaxed);
+        key_ = table ? board.hash() : 0;
+        shared_ = table ? table->insert(key_) : nullptr;
+        parent_ = parent;
+        edge_ = edge;
+        firstEdge_ = 0;
+        numEdges_ = 0;
+    }
+
+    bool isLeafNode() const {
+        return state_.load(std::memory_order_acquire) != EXPANDED
+            || numEdges_ == 0
+            || board_.isFilled()
+            || (parent_ && isPassMove_ && parent_->isPassMove_);
+    }
+
+    // Only the thread that wins the UNEXPANDED -> EXPANDING transition lists
+    // the moves; everybody else keeps treating the node as a leaf until the
+    // edges are published. Once the pool has used up its budget nothing is
+    // expanded any more, and the search carries on with playouts from the
+    // existing leaves.
+    void expand(NodePool& pool, const SearchConfig& config);
+
+    // Expands a root with legal moves before a search, whatever the
+    // threshold and the budget, so that there is a move to pick. Only a
+    // full block table can leave it without edges.
+    void expandRoot(NodePool& pool);
+
+    // Returns the node behind `edge`, building it on the first visit, or
+    // nullptr if it cannot be built right now.
+    Node* descend(NodePool& pool, Edge edge, const SearchConfig& config);
+
+    Edge getEdgeWithMaxUCB(const NodePool& pool, const SearchConfig& config) const;
+
+    Edge getEdgeWithMaxVisits(const NodePool& pool) const;
+
+    // Backs up `count` playouts whose occupations sum to `total` along the
+    // nodes of a descent, root first. `edge` is set when the descent ended
+    // at an edge below the last node whose child could not be built. Every
+    // edge on the way carries one virtual loss however many playouts ran.
+    static void backup(const std::vector<Node*>& path, Edge edge, uint32_t count, float total, bool virtualLoss) {
+        if (edge) {
+            addResults(edge.games(), edge.sum(), count, total);
+            if (virtualLoss) {
+                edge.virtualLoss().fetch_sub(1, std::memory_order_relaxed);
+            }
+            total = count - total;
+        }
+        for (size_t i = path.size(); i-- > 0;) {
+            Node& node = *path[i];
+            if (node.getSharedEntry()) {
+                addResults(node.shared_->games, node.shared_->sum, count, total);
+            }
+            addResults(node.edge_.games(), node.edge_.sum(), count, total);
+            if (virtualLoss && i > 0) {
+                node.edge_.virtualLoss().fetch_sub(1, std::memory_order_relaxed);
+            }
+            total = count - total;
+        }
+    }
+
+    const Board& getBoard() const {
+        return board_;
+    }
+
+    size_t getNumGames() const {
+        return edge_.getNumGames();
+    }
+
+    float getMean() const {
+        return edge_.getMean();
+    }
+
+    float getExpectedOccupation() const {
+        return 1 - getMean();
+    }
+
+    size_t getNumEdges() const {
+        return state_.load(std::memory_order_acquire) == EXPANDED ? numEdges_ : 0;
+    }
+
+    Edge getEdge(const NodePool& pool, size_t i) const;
+
+private:
+    friend class Tree;
+
+    enum : uint8_t {
+        UNEXPANDED, EXPANDING, EXPANDED
+    };
+
+    Board board_;
+    bool isPassMove_;
+    std::atomic<uint8_t> state_;
+    uint64_t key_;
+    NodeTable::Entry* shared_;
+
+    Node* parent_;
+    Edge edge_;
+    NodeIndex firstEdge_;
+    NodeIndex numEdges_;
+
+    const NodeTable::Entry* getSharedEntry() const {
+        return (shared_ && shared_->key.load(std::memory_order_relaxed) == key_) ? shared_ : nullptr;
+    }
+
+    // Transpositions share their mean, while exploration still counts the
+    // visits made through this particular edge.
+    float getValueEstimate() const {
+        const NodeTable::Entry* entry = getSharedEntry();
+        if (entry && entry->games.load(std::memory_order_relaxed) > 0) {
+            return getMeanResult(entry->games, entry->sum);
+        }
+        return getMean();
+    }
+
+    Edge getEdges(const NodePool& pool) const;
+
+    void addEdges(NodePool& pool);
+
+    template<typename Eval>
+    Edge getEdgeWithMaxValue(Edge edges, Eval eval) const {
+        assert(numEdges_ > 0);
+
+        NodeIndex best = 0;
+        auto bestValue = eval(edges);
+        for (NodeIndex i = 1; i < numEdges_; ++i) {
+            const auto value = eval(edges.offset(i));
+            if (value > bestValue) {
+                best = i;
+                bestValue = value;
+            }
+        }
+
+        return edges.offset(best);
+    }
+};
+
+// The nodes and edges of one tree, and the budget they have to fit in.
+struct NodePool {
+    Arena<Node> nodes;
+    EdgeArena edges;
+    size_t maxBytes = 0;
+
+    void reset() {
+        nodes.reset();
+        edges.reset();
+    }
+
+    void release() {
+        nodes.release();
+        edges.release();
+    }
+
+    void setBudget(size_t maxNodes, size_t maxMemory) {
+        nodes.setCapacity(maxNodes ? maxNodes : SIZE_MAX);
+        maxBytes = maxMemory;
+    }
+
+    size_t getMemoryUsage() const {
+        return nodes.getReservedBytes() + edges.getReservedBytes();
+    }
+
+    bool isFull() const {
+        return nodes.isFull() || edges.isFull() || (maxBytes && getMemoryUsage() >= maxBytes);
+    }
+};
+
+inline void Node::expand(NodePool& pool, const SearchConfig& config) {
+    if (getNumGames() < config.expandThreshold || pool.isFull()) {
+        return;
+    }
+    addEdges(pool);
+}
+
+inline void Node::expandRoot(NodePool& pool) {
+    assert(!parent_);
+    if (board_.getLegalMoves()) {
+        addEdges(pool);
+    }
+}
+
+inline void Node::addEdges(NodePool& pool) {
+    uint8_t expected = UNEXPANDED;
+    if (!state_.compare_exchange_strong(expected, EXPANDING, std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Running out of edges leaves the node a leaf, as a full node pool does.
+    const Bitboard moves = board_.getLegalMoves();
+    const bool isPassMove = !moves;
+    if (isPassMove) {
+        assert(parent_);
+        if (!parent_->isPassMove_) {
+            const size_t first = pool.edges.tryAllocate(1);
+            if (first == EdgeArena::NO_INDEX) {
+                state_.store(UNEXPANDED, std::memory_order_relaxed);
+                return;
+            }
+            firstEdge_ = first;
+            pool.edges[firstEdge_].init(PASS_MOVE);
+            numEdges_ = 1;
+            STATS(++SearchStats::local().edgesAllocated);
+        }
+    } else {
+        const size_t n = popCount(moves);
+        const size_t first = pool.edges.tryAllocate(n);
+        if (first == EdgeArena::NO_INDEX) {
+            state_.store(UNEXPANDED, std::memory_order_relaxed);
+            return;
+        }
+        firstEdge_ = first;
+        const Edge edges = pool.edges[firstEdge_];
+        size_t i = 0;
+        for (Bitboard rest = moves; rest; rest &= rest - 1) {
+            edges.offset(i++).init(lowestSquare(rest));
+        }
+        numEdges_ = n;
+        STATS(SearchStats::local().edgesAllocated += n);
+    }
+    STATS(++SearchStats::local().expansions);
+    isPassMove_ = isPassMove;
+    state_.store(EXPANDED, std::memory_order_release);
+}
+
+inline Node* Node::descend(NodePool& pool, Edge edge, const SearchConfig& config) {
+    NodeIndex idx = edge.child().load(std::memory_order_acquire);
+    if (idx == Edge::NO_CHILD && !pool.isFull()
+            && edge.child().compare_exchange_strong(idx, Edge::PENDING, std::memory_order_acquire)) {
+        const size_t slot = pool.nodes.tryAllocate(1);
+        if (slot == Arena<Node>::NO_INDEX) {
+            edge.child().store(Edge::NO_CHILD, std::memory_order_relaxed);
+            return nullptr;
+        }
+        STATS(++SearchStats::local().nodesAllocated);
+        Node& node = pool.nodes[slot];
+        node.init(edge.apply(board_), this, edge, config.table);
+        edge.child().store(slot, std::memory_order_release);
+        return &node;
+    }
+    if (idx == Edge::NO_CHILD || idx == Edge::PENDING) {
+        return nullptr;
+    }
+    return &pool.nodes[idx];
+}
+
+inline Edge Node::getEdges(const NodePool& pool) const {
+    return pool.edges[firstEdge_];
+}
+
+inline Edge Node::getEdge(const NodePool& pool, size_t i) const {
+    assert(i < getNumEdges());
+    return pool.edges[firstEdge_ + i];
+}
+
+inline Edge Node::getEdgeWithMaxUCB(const NodePool& pool, const SearchConfig& config) const {
+    const size_t parentVisits = getNumGames() + edge_.virtualLoss().load(std::memory_order_relaxed);
+    const float parentTerm = UCBTables::getParentTerm(config.exploration, parentVisits);
+    if (!config.table) {
+        return getEdgeWithMaxValue(getEdges(pool), [parentTerm](Edge edge) {
+            return edge.calcUCB(parentTerm, edge.getMean());
+        });
+    }
+    return getEdgeWithMaxValue(getEdges(pool), [parentTerm, &pool](Edge edge) {
+        const NodeIndex child = edge.getChild();
+        const float value = (child == Edge::NO_CHILD) ? edge.getMean() : pool.nodes[child].getValueEstimate();
+        return edge.calcUCB(parentTerm, value);
+    });
+}
+
+inline Edge Node::getEdgeWithMaxVisits(const NodePool& pool) const {
+    return getEdgeWithMaxValue(getEdges(pool), [](Edge edge) {
+        return edge.getNumGames();
+    });
+}
+
+// Owns the search tree between moves. Moving the root down to a child copies
+// that child's subtree into a spare pool and swaps the two, so the tree
+// stays packed and the rest of the old tree is dropped in O(1).
+class Tree {
+public:
+    Tree() : pool_(new NodePool), spare_(new NodePool), root_(nullptr) {}
+
+    Node& getRoot() {
+        assert(root_);
+        return *root_;
+    }
+
+    NodePool& getPool() {
+        return *pool_;
+    }
+
+    // One pool per thread for --parallel root, which grows separate trees
+    // and throws them away after every move.
+    std::vector<std::unique_ptr<NodePool>>& getRootParallelPools() {
+        return rootParallelPools_;
+    }
+
+    void reset(const Board& board) {
+        pool_->reset();
+        root_ = newRoot(*pool_, board);
+    }
+
+    // Keeps the statistics gathered for `board` if it is the root or one of
+    // its children, and starts a fresh tree otherwise.
+    void advance(const Board& board) {
+        if (root_ && root_->getBoard() == board) {
+            return;
+        }
+        if (root_) {
+            for (size_t i = 0; i < root_->getNumEdges(); ++i) {
+                const NodeIndex child = root_->getEdge(*pool_, i).getChild();
+                if (child != Edge::NO_CHILD && pool_->nodes[child].getBoard() == board) {
+                    promote(pool_->nodes[child]);
+                    return;
+                }
+            }
+        }
+        reset(board);
+    }
+
+    // Writes the tree as a snapshot: a header with the root position and
+    // its statistics, followed by one fixed-size record per edge in
+    // breadth-first order. Only the children visited at least `minVisits`
+    // times are kept, with their whole subtree above the threshold; boards
+    // are not stored, as they follow from the moves.
+    bool save(std::ostream& out, size_t minVisits) const {
+        assert(root_);
+        std::vector<SnapshotEdge> records;
+        std::vector<const Node*> queue(1, root_);
+        for (size_t head = 0; head < queue.size(); ++head) {
+            const Node& node = *queue[head];
+            for (size_t i = 0; i < node.getNumEdges(); ++i) {
+                const Edge edge = node.getEdge(*pool_, i);
+                SnapshotEdge record = SnapshotEdge();
+                record.sum = edge.sum().load(std::memory_order_relaxed);
+                record.games = edge.getNumGames();
+                record.move = edge.getMove();
+                const NodeIndex child = edge.getChild();
+                if (child != Edge::NO_CHILD && edge.getNumGames() >= minVisits) {
+                    record.hasChild = 1;
+                    record.childEdges = pool_->nodes[child].getNumEdges();
+                    queue.push_back(&pool_->nodes[child]);
+                }
+                records.push_back(record);
+            }
+        }
+
+        SnapshotHeader header = SnapshotHeader();
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.boardSize = BOARD_SIZE;
+        const Board& board = root_->getBoard();
+        header.player = static_cast<uint32_t>(board.getPlayer());
+        for (size_t side = 0; side < 2; ++side) {
+            const unsigned __int128 discs = board.getDiscs(static_cast<Player>(side));
+            header.discs[side][0] = static_cast<uint64_t>(discs);
+            header.discs[side][1] = static_cast<uint64_t>(discs >> 64);
+        }
+        header.rootSum = root_->edge_.sum().load(std::memory_order_relaxed);
+        header.rootGames = root_->getNumGames();
+        header.rootEdges = root_->getNumEdges();
+        header.numEdges = records.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SnapshotEdge));
+        return static_cast<bool>(out);
+    }
+
+    // Replaces the tree by a snapshot written by save(), and checks every
+    // move on the way. A snapshot that does not fit leaves the tree alone.
+    bool load(std::istream& in, NodeTable* table) {
+        try {
+            return loadSnapshot(in, table);
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+    }
+
+    static Node* newRoot(NodePool& pool, const Board& board) {
+        const Edge edge = pool.edges[pool.edges.allocate(1)];
+        edge.init(PASS_MOVE);
+        const size_t idx = pool.nodes.allocate(1);
+        Node& root = pool.nodes[idx];
+        root.init(board, nullptr, edge, nullptr);
+        edge.child().store(idx, std::memory_order_relaxed);
+        return &root;
+    }
+
+private:
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t boardSize;
+        uint32_t player;
+        uint64_t discs[2][2];
+        uint64_t rootSum;
+        uint32_t rootGames;
+        uint32_t rootEdges;
+        uint64_t numEdges;
+    };
+
+    struct SnapshotEdge {
+        uint64_t sum;
+        uint32_t games;
+        uint8_t move;
+        uint8_t hasChild;
+        uint8_t childEdges;
+        uint8_t padding;
+    };
+    static_assert(sizeof(SnapshotEdge) == 16, "the record layout is part of the file format");
+
+    static constexpr char SNAPSHOT_MAGIC[8] = {'M', 'C', 'R', 'T', 'R', 'E', 'E', '1'};
+
+    std::unique_ptr<NodePool> pool_;
+    std::unique_ptr<NodePool> spare_;
+    Node* root_;
+    std::vector<std::pair<const Node*, Node*>> queue_;
+    std::vector<std::unique_ptr<NodePool>> rootParallelPools_;
+
+    static void copyStats(Edge from, Edge to) {
+        to.games().store(from.getNumGames(), std::memory_order_relaxed);
+        to.sum().store(from.sum().load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    static void copyNode(const Node& from, Node& to) {
+        to.isPassMove_ = from.isPassMove_;
+        to.key_ = from.key_;
+        to.shared_ = from.shared_;
+    }
+
+    void promote(const Node& node) {
+        spare_->reset();
+        Node* root = newRoot(*spare_, node.getBoard());
+        copyStats(node.edge_, root->edge_);
+        copyNode(node, *root);
+
+        queue_.clear();
+        queue_.emplace_back(&node, root);
+        for (size_t head = 0; head < queue_.size(); ++head) {
+            const Node& from = *queue_[head].first;
+            Node& to = *queue_[head].second;
+            const size_t n = from.getNumEdges();
+            if (n == 0) {
+                continue;
+            }
+            to.firstEdge_ = spare_->edges.allocate(n);
+            to.numEdges_ = n;
+            to.state_.store(Node::EXPANDED, std::memory_order_relaxed);
+            for (size_t i = 0; i < n; ++i) {
+                const Edge edge = from.getEdge(*pool_, i);
+                const Edge edgeCopy = spare_->edges[to.firstEdge_ + i];
+                edgeCopy.init(edge.getMove());
+                copyStats(edge, edgeCopy);
+                const NodeIndex child = edge.getChild();
+                if (child == Edge::NO_CHILD) {
+                    continue;
+                }
+                const Node& childNode = pool_->nodes[child];
+                const size_t idx = spare_->nodes.allocate(1);
+                Node& childCopy = spare_->nodes[idx];
+                childCopy.init(childNode.getBoard(), &to, edgeCopy, nullptr);
+                copyNode(childNode, childCopy);
+                edgeCopy.child().store(idx, std::memory_order_relaxed);
+                queue_.emplace_back(&childNode, &childCopy);
+            }
+        }
+
+        usePool(root);
+    }
+
+    bool loadSnapshot(std::istream& in, NodeTable* table) {
+        SnapshotHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+                || header.boardSize != BOARD_SIZE || header.player > 1 || header.rootEdges > header.numEdges) {
+            return false;
+        }
+        // Read in chunks, so that a corrupt count runs into the end of the
+        // file instead of into an allocation the size of the count.
+        const size_t CHUNK_EDGES = 1 << 16;
+        std::vector<SnapshotEdge> records;
+        while (records.size() < header.numEdges) {
+            const size_t n = std::min<uint64_t>(CHUNK_EDGES, header.numEdges - records.size());
+            records.resize(records.size() + n);
+            if (!in.read(reinterpret_cast<char*>(&records[records.size() - n]), n * sizeof(SnapshotEdge))) {
+                return false;
+            }
+        }
+        Bitboard discs[2];
+        for (size_t side = 0; side < 2; ++side) {
+            discs[side] = static_cast<Bitboard>(header.discs[side][0] | static_cast<unsigned __int128>(header.discs[side][1]) << 64);
+        }
+        const Player player = static_cast<Player>(header.player);
+        const Board board(discs[static_cast<size_t>(player)], discs[1 - static_cast<size_t>(player)], player);
+        if ((discs[0] & discs[1]) || ((discs[0] | discs[1]) & ~ALL_SQUARES)) {
+            return false;
+        }
+
+        spare_->reset();
+        Node* root = newRoot(*spare_, board);
+        root->edge_.games().store(header.rootGames, std::memory_order_relaxed);
+        root->edge_.sum().store(header.rootSum, std::memory_order_relaxed);
+        if (table) {
+            root->key_ = board.hash();
+            root->shared_ = table->insert(root->key_);
+        }
+        std::vector<std::pair<Node*, size_t>> queue(1, std::make_pair(root, static_cast<size_t>(header.rootEdges)));
+        size_t next = 0;
+        for (size_t head = 0; head < queue.size(); ++head) {
+            Node& node = *queue[head].first;
+            const size_t n = queue[head].second;
+            if (n == 0) {
+                continue;
+            }
+            if (next + n > records.size()) {
+                return false;
+            }
+            // An expanded node has an edge for every legal move, or a single
+            // pass edge unless the move before was a pass as well.
+            const Bitboard moves = node.getBoard().getLegalMoves();
+            const size_t expected = moves ? popCount(moves) : (node.parent_ && !node.parent_->isPassMove_) ? 1 : 0;
+            if (n != expected) {
+                return false;
+            }
+            node.firstEdge_ = spare_->edges.allocate(n);
+            node.numEdges_ = n;
+            node.isPassMove_ = !moves;
+            Bitboard seen = 0;
+            for (size_t i = 0; i < n; ++i) {
+                const SnapshotEdge& record = records[next++];
+                const Bitboard bit = (record.move < BOARD_CELLS) ? static_cast<Bitboard>(1) << record.move : 0;
+                const bool legal = (record.move == PASS_MOVE) ? !moves : (bit & moves & ~seen) != 0;
+                if (!legal) {
+                    return false;
+                }
+                seen |= bit;
+                const Edge edge = spare_->edges[node.firstEdge_ + i];
+                edge.init(record.move);
+                edge.games().store(record.games, std::memory_order_relaxed);
+                edge.sum().store(record.sum, std::memory_order_relaxed);
+                if (record.hasChild) {
+                    const size_t idx = spare_->nodes.allocate(1);
+                    Node& child = spare_->nodes[idx];
+                    child.init(edge.apply(node.getBoard()), &node, edge, table);
+                    edge.child().store(idx, std::memory_order_relaxed);
+                    queue.emplace_back(&child, record.childEdges);
+                }
+            }
+            node.state_.store(Node::EXPANDED, std::memory_order_relaxed);
+        }
+        if (next != records.size()) {
+            return false;
+        }
+
+        usePool(root);
+        return true;
+    }
+
+    // Makes the spare pool, where `root` has been built, the live one. A
+    // pool that was searched with a memory budget gives its blocks back, so
+    // that the budget bounds the whole tree rather than each of the two.
+    void usePool(Node* root) {
+        std::swap(pool_, spare_);
+        root_ = root;
+        if (spare_->maxBytes) {
+            spare_->release();
+        }
+    }
+};
+
+constexpr char Tree::SNAPSHOT_MAGIC[8];
+
+// Either a fixed time per move, or a budget for the whole game plus an
+// increment per move which is spread over the moves we still expect to make.
+class TimeManager {
+public:
+    TimeManager() : moveTime_(1), gameClock_(false), remaining_(0), increment_(0) {}
+
+    void setMoveTime(float sec) {
+        moveTime_ = sec;
+    }
+
+    void setGameTime(float totalSec, float incrementSec) {
+        gameClock_ = true;
+        remaining_ = totalSec;
+        increment_ = incrementSec;
+    }
+
+    float allocate(const Board& board) const {
+        if (!gameClock_) {
+            return moveTime_;
+        }
+        const size_t movesLeft = std::max<size_t>(1, (board.getNumEmpties() + 1) / 2);
+        const float share = remaining_ / movesLeft + increment_;
+        return std::max(0.0f, std::min(share, remaining_ + increment_ - SAFETY_MARGIN_SEC));
+    }
+
+    void charge(float elapsedSec) {
+        if (gameClock_) {
+            remaining_ += increment_ - elapsedSec;
+        }
+    }
+
+private:
+    static constexpr float SAFETY_MARGIN_SEC = 0.05f;
+
+    float moveTime_;
+    bool gameClock_;
+    float remaining_;
+    float increment_;
+};
+
+// With PlayoutPolicy::HEURISTIC a corner is always taken, and otherwise
+// moves are drawn with weights by square class: edges over the interior
+// over the C and X squares of an empty corner. It only costs a few masks
+// and popcounts per move.
+size_t choosePlayoutMove(Bitboard moves, Bitboard empty, PlayoutPolicy policy, RNG& rng) {
+    if (policy == PlayoutPolicy::UNIFORM) {
+        return rng.randomSquare(moves);
+    }
+    const Bitboard corners = moves & Geometry::CORNERS;
+    if (corners) {
+        return rng.randomSquare(corners);
+    }
+
+    const size_t EDGE_WEIGHT = 4;
+    const size_t INNER_WEIGHT = 2;
+    const size_t DANGER_WEIGHT = 1;
+    Bitboard danger = 0;
+    for (size_t c = 0; c < 4; ++c) {
+        if (empty & Geometry::corner(c)) {
+            danger |= Geometry::cornerNeighbours(c);
+        }
+    }
+    const Bitboard risky = moves & danger;
+    const Bitboard edges = moves & Geometry::EDGES & ~danger;
+    const Bitboard inner = moves & ~Geometry::EDGES & ~danger;
+    const size_t edgeTotal = EDGE_WEIGHT * popCount(edges);
+    const size_t innerTotal = INNER_WEIGHT * popCount(inner);
+    size_t pick = rng.randomIndex(edgeTotal + innerTotal + DANGER_WEIGHT * popCount(risky));
+    if (pick < edgeTotal) {
+        return nthSquare(edges, pick / EDGE_WEIGHT);
+    }
+    pick -= edgeTotal;
+    if (pick < innerTotal) {
+        return nthSquare(inner, pick / INNER_WEIGHT);
+    }
+    return nthSquare(risky, (pick - innerTotal) / DANGER_WEIGHT);
+}
+
+// Guesses the final occupation of the side to move from mobility and
+// corners, for playouts that stop early. The disc count is left out: in
+// the midgame it says little, and self-play games were stronger without it.
+float evaluate(Bitboard own, Bitboard opp, Bitboard ownMoves) {
+    const float MOBILITY_WEIGHT = 0.7f;
+    const float CORNER_WEIGHT = 0.3f;
+    const Bitboard oppMoves = Board(opp, own, Player::BLACK).getLegalMoves();
+    const int ownMobility = popCount(ownMoves);
+    const int oppMobility = popCount(oppMoves);
+    const int ownCorners = popCount(own & Geometry::CORNERS);
+    const int oppCorners = popCount(opp & Geometry::CORNERS);
+    const float score = MOBILITY_WEIGHT * (ownMobility - oppMobility) / (ownMobility + oppMobility + 1)
+        + CORNER_WEIGHT * (ownCorners - oppCorners) / 4;
+    return 0.5f + 0.5f * std::max(-1.0f, std::min(score, 1.0f));
+}
+
+// A playout with a cutoff stops after that many plies, or earlier once one
+// side holds three corners more than the other.
+inline bool isCutOff(Bitboard own, Bitboard opp, size_t plies, size_t cutoff) {
+    if (!cutoff) {
+        return false;
+    }
+    const int corners = static_cast<int>(popCount(own & Geometry::CORNERS)) - static_cast<int>(popCount(opp & Geometry::CORNERS));
+    return plies >= cutoff || std::abs(corners) >= 3;
+}
+
+// Plays moves picked by the playout policy until the game is over, or
+// until the cutoff, and returns the occupation of the player who moved into
+// `board`.
+float randomPlayout(const Board& board, const SearchConfig& config) {
+    RNG& rng = RNG::getSingleton();
+    Board current = board;
+    bool passed = false;
+    STATS(++SearchStats::local().playouts);
+    for (size_t plies = 0; !current.isFilled(); ++plies) {
+        STATS(++SearchStats::local().playoutPlies);
+        const Bitboard moves = current.getLegalMoves();
+        const Bitboard own = current.getDiscs(current.getPlayer());
+        const Bitboard opp = current.getDiscs(opponent(current.getPlayer()));
+        if (isCutOff(own, opp, plies, config.playoutCutoff)) {
+            const float value = evaluate(own, opp, moves);
+            return (plies % 2 == 0) ? 1 - value : value;
+        }
+        if (!moves) {
+            if (passed) {
+                break;
+            }
+            passed = true;
+            current.pass();
+        } else {
+            passed = false;
+            current.play(choosePlayoutMove(moves, ~(own | opp), config.policy, rng));
+        }
+    }
+
+    return current.getOccupation(opponent(board.getPlayer()));
+}
+
+// Like randomPlayout(), but leaves that are close enough to the end are
+// solved instead.
+float playout(const Board& board, const SearchConfig& config) {
+    if (board.getNumEmpties() <= config.exactLeafEmpties) {
+        static thread_local EndgameSolver solver;
+        const int score = solver.solve(board);
+        return static_cast<float>(static_cast<int>(BOARD_CELLS) - score) / (2 * BOARD_CELLS);
+    }
+    return randomPlayout(board, config);
+}
+
+// Sums `count` playouts from `board`. A solved leaf scores the same every
+// time, so it is only solved once.
+float playouts(const Board& board, const SearchConfig& config, size_t count) {
+    STATS(PhaseTimer timer(SearchStats::PLAYOUT));
+    if (board.getNumEmpties() <= config.exactLeafEmpties) {
+        return count * playout(board, config);
+    }
+    float total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += playout(board, config);
+    }
+    return total;
+}
+
+// Lane-parallel playouts: every lane holds its own board and all of them
+// step together through the same shift/mask move generator. The lane count
+// follows the widest vector unit the compiler was allowed to target.
+// There are no vectors of 128-bit integers, so boards that need them are
+// played out one by one.
+#if REVERSI_BOARD_SIZE > 8
+const size_t PLAYOUT_LANES = 1;
+
+void playoutBatch(const Board* boards, float* results, size_t count, const SearchConfig& config) {
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = randomPlayout(boards[i], config);
+    }
+}
+#else
+#if defined(__AVX512F__)
+const size_t PLAYOUT_LANES = 8;
+#elif defined(__AVX2__)
+const size_t PLAYOUT_LANES = 4;
+#elif defined(__SSE2__)
+const size_t PLAYOUT_LANES = 2;
+#else
+const size_t PLAYOUT_LANES = 1;
+#endif
+
+typedef Bitboard Lanes __attribute__((vector_size(PLAYOUT_LANES * sizeof(Bitboard))));
+
+inline Lanes shiftLanes(Lanes bits, size_t dir) {
+    const int amount = DIRECTION_SHIFTS[dir];
+    if (amount > 0) {
+        return (bits << amount) & DIRECTION_MASKS[dir];
+    } else {
+        return (bits >> -amount) & DIRECTION_MASKS[dir];
+    }
+}
+
+inline Lanes getLegalMoves(Lanes own, Lanes opp) {
+    const Lanes empty = ~(own | opp);
+    Lanes moves = {};
+    for (size_t dir = 0; dir < NUM_DIRECTIONS; ++dir) {
+        Lanes run = shiftLanes(own, dir) & opp;
+        for (size_t i = 2; i < BOARD_SIZE - 1; ++i) {
+            run |= shiftLanes(run, dir) & opp;
+        }
+        moves |= shiftLanes(run, dir) & empty;
+    }
+    return moves;
+}
+
+// A lane whose move is zero gets no flips, which lets it pass in step.
+inline Lanes getFlips(Lanes own, Lanes opp, Lanes move) {
+    Lanes flips = {};
+    for (size_t dir = 0; dir < NUM_DIRECTIONS; ++dir) {
+        Lanes run = shiftLanes(move, dir) & opp;
+        for (size_t i = 2; i < BOARD_SIZE - 1; ++i) {
+            run |= shiftLanes(run, dir) & opp;
+        }
+        const Lanes bounded = static_cast<Lanes>((shiftLanes(run, dir) & own) != 0);
+        flips |= run & bounded;
+    }
+    return flips;
+}
+
+// Plays out `boards[i]` into `results[i]`, with the same meaning as
+// playout(). Lanes that finish early pick up the next board, so the vector
+// stays full until the batch runs dry.
+void playoutBatch(const Board* boards, float* results, size_t count, const SearchConfig& config) {
+    RNG& rng = RNG::getSingleton();
+    Lanes own = {}, opp = {};
+    size_t job[PLAYOUT_LANES];
+    size_t plies[PLAYOUT_LANES];
+    bool passed[PLAYOUT_LANES];
+    bool active[PLAYOUT_LANES];
+    size_t next = 0;
+
+    // A fresh board goes in swapped as if its lane had just passed, since
+    // every step ends by swapping sides.
+    auto load = [&](size_t lane) {
+        active[lane] = next < count;
+        if (active[lane]) {
+            job[lane] = next++;
+            own[lane] = boards[job[lane]].getDiscs(opponent(boards[job[lane]].getPlayer()));
+            opp[lane] = boards[job[lane]].getDiscs(boards[job[lane]].getPlayer());
+            plies[lane] = SIZE_MAX;
+            passed[lane] = false;
+        } else {
+            own[lane] = opp[lane] = 0;
+        }
+    };
+
+    for (size_t lane = 0; lane < PLAYOUT_LANES; ++lane) {
+        load(lane);
+    }
+    Lanes move = {};
+    for (;;) {
+        const Lanes flips = getFlips(own, opp, move);
+        const Lanes mover = own | flips | move;
+        own = opp & ~flips;
+        opp = mover;
+
+        const Lanes moves = getLegalMoves(own, opp);
+        bool busy = false;
+        for (size_t lane = 0; lane < PLAYOUT_LANES; ++lane) {
+            move[lane] = 0;
+            if (!active[lane]) {
+                continue;
+            }
+            ++plies[lane];
+            const bool filled = (own[lane] | opp[lane]) == ALL_SQUARES;
+            if (!moves[lane] && (passed[lane] || filled)) {
+                // An even ply count means the side to move is the one that
+                // started, so its opponent holds `opp`.
+                const Bitboard discs = (plies[lane] % 2 == 0) ? opp[lane] : own[lane];
+                results[job[lane]] = static_cast<float>(popCount(discs)) / BOARD_CELLS;
+                STATS(++SearchStats::local().playouts);
+                STATS(SearchStats::local().playoutPlies += plies[lane]);
+                load(lane);
+                busy |= active[lane];
+                continue;
+            }
+            if (isCutOff(own[lane], opp[lane], plies[lane], config.playoutCutoff)) {
+                const float value = evaluate(own[lane], opp[lane], moves[lane]);
+                results[job[lane]] = (plies[lane] % 2 == 0) ? 1 - value : value;
+                STATS(++SearchStats::local().playouts);
+                STATS(SearchStats::local().playoutPlies += plies[lane]);
+                load(lane);
+                busy |= active[lane];
+                continue;
+            }
+            busy = true;
+            passed[lane] = !moves[lane];
+            if (moves[lane]) {
+                const Bitboard empty = ~(own[lane] | opp[lane]);
+                move[lane] = static_cast<Bitboard>(1) << choosePlayoutMove(moves[lane], empty, config.policy, rng);
+            }
+        }
+        if (!busy) {
+            break;
+        }
+    }
+}
+#endif
+
+// A leaf picked for a playout, with the nodes the descent went through.
+// When the child below `edge` could not be built, the result is backed up
+// through the edge instead of a node.
+struct Leaf {
+    std::vector<Node*> path;
+    Edge edge;
+    Board board;
+};
+
+void selectLeaf(Node& root, NodePool& pool, const SearchConfig& config, bool virtualLoss, Leaf& leaf) {
+    STATS(PhaseTimer timer(SearchStats::SELECTION));
+    STATS(++SearchStats::local().descents);
+    leaf.path.clear();
+    leaf.edge = Edge();
+    Node* current = &root;
+    leaf.path.push_back(current);
+    while (!current->isLeafNode()) {
+        const Edge edge = current->getEdgeWithMaxUCB(pool, config);
+        if (virtualLoss) {
+            edge.addVirtualLoss();
+        }
+        Node* child = current->descend(pool, edge, config);
+        if (!child) {
+            leaf.edge = edge;
+            leaf.board = edge.apply(current->getBoard());
+            break;
+        }
+        current = child;
+        leaf.path.push_back(current);
+    }
+    if (!leaf.edge) {
+        leaf.board = current->getBoard();
+    }
+    STATS(const uint64_t depth = leaf.path.size() - (leaf.edge ? 0 : 1));
+    STATS(SearchStats::local().depthSum += depth);
+    STATS(SearchStats::local().maxDepth = std::max(SearchStats::local().maxDepth, depth));
+}
+
+void propagateLeaf(const Leaf& leaf, NodePool& pool, const SearchConfig& config, float total, bool virtualLoss) {
+    {
+        STATS(PhaseTimer timer(SearchStats::BACKUP));
+        Node::backup(leaf.path, leaf.edge, config.playoutsPerLeaf, total, virtualLoss);
+    }
+    if (!leaf.edge) {
+        STATS(PhaseTimer timer(SearchStats::EXPANSION));
+        leaf.path.back()->expand(pool, config);
+    }
+}
+
+// Collects `config.batchSize` leaves before playing any of them out, each
+// with `config.playoutsPerLeaf` boards in the batch. Virtual
+// loss is what keeps the selections of one batch from all landing on the
+// same leaf, so it is applied even on a single thread.
+void runBatchedSearch(Node& root, NodePool& pool, const SearchConfig& config, Deadline deadline) {
+    std::vector<Leaf> leaves(config.batchSize);
+    std::vector<Board> boards;
+    std::vector<float> results;
+    while (!deadline.reached(config.batchSize * config.playoutsPerLeaf)) {
+        boards.clear();
+        for (Leaf& leaf : leaves) {
+            selectLeaf(root, pool, config, true, leaf);
+            if (leaf.board.getNumEmpties() > config.exactLeafEmpties) {
+                boards.insert(boards.end(), config.playoutsPerLeaf, leaf.board);
+            }
+        }
+        results.resize(boards.size());
+        {
+            STATS(PhaseTimer timer(SearchStats::PLAYOUT));
+            playoutBatch(boards.data(), results.data(), boards.size(), config);
+        }
+
+        const float* next = results.data();
+        for (const Leaf& leaf : leaves) {
+            float total;
+            if (leaf.board.getNumEmpties() > config.exactLeafEmpties) {
+                total = std::accumulate(next, next + config.playoutsPerLeaf, 0.0f);
+                next += config.playoutsPerLeaf;
+            } else {
+                total = playouts(leaf.board, config, config.playoutsPerLeaf);
+            }
+            propagateLeaf(leaf, pool, config, total, true);
+        }
+    }
+}
+
+void runSearch(Node& root, NodePool& pool, const SearchConfig& config, bool virtualLoss, Deadline deadline) {
+    if (config.batchSize > 1) {
+        runBatchedSearch(root, pool, config, deadline);
+    } else {
+        Leaf leaf;
+        while (!deadline.reached(config.playoutsPerLeaf)) {
+            selectLeaf(root, pool, config, virtualLoss, leaf);
+            propagateLeaf(leaf, pool, config, playouts(leaf.board, config, config.playoutsPerLeaf), virtualLoss);
+        }
+    }
+    STATS(SearchStats::collect());
+}
+
+// Every thread grows a private tree from the same root. Edges come out of
+// expand() in move order, so the root statistics can be merged by index.
+// The node table is left out here, sharing it would couple the trees again.
+// The per-thread pools belong to `tree`, so that concurrent callers with
+// trees of their own never share them.
+Board searchMoveRootParallel(Tree& tree, const Board& board, SearchConfig config, Deadline deadline) {
+    const size_t threads = config.threads;
+    config.table = nullptr;
+    std::vector<std::unique_ptr<NodePool>>& pools = tree.getRootParallelPools();
+    while (pools.size() < threads) {
+        pools.emplace_back(new NodePool);
+    }
+
+    std::vector<Node*> roots;
+    for (size_t i = 0; i < threads; ++i) {
+        NodePool& pool = *pools[i];
+        pool.reset();
+        pool.setBudget(config.maxNodes ? std::max<size_t>(config.maxNodes / threads, 1) : 0, config.maxMemory / threads);
+        roots.push_back(Tree::newRoot(pool, board));
+        roots.back()->expandRoot(pool);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(runSearch, std::ref(*roots[i]), std::ref(*pools[i]), std::cref(config), false, deadline);
+    }
+    runSearch(*roots[0], *pools[0], config, false, deadline);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const Bitboard moves = board.getLegalMoves();
+    const size_t numMoves = popCount(moves);
+    std::vector<size_t> games(numMoves, 0);
+    std::vector<float> totals(numMoves, 0);
+    size_t rootGames = 0;
+    float rootTotal = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        rootGames += roots[i]->getNumGames();
+        rootTotal += roots[i]->getNumGames() * roots[i]->getExpectedOccupation();
+        if (roots[i]->getNumEdges() != numMoves) {
+            continue;
+        }
+        for (size_t j = 0; j < numMoves; ++j) {
+            const Edge edge = roots[i]->getEdge(*pools[i], j);
+            games[j] += edge.getNumGames();
+            totals[j] += edge.getNumGames() * edge.getMean();
+        }
+    }
+    // Nothing is kept from one move to the next, so under a memory budget
+    // the trees do not hold on to their blocks in between either.
+    if (config.maxMemory) {
+        for (size_t i = 0; i < threads; ++i) {
+            pools[i]->release();
+        }
+    }
+
+    if (config.verbose) {
+        std::cout << "#games: " << rootGames << ", occupation: " << rootTotal / std::max<size_t>(rootGames, 1) << "\n";
+        STATS(SearchStats::dump(std::cout));
+    }
+
+    const size_t best = std::distance(games.begin(), std::max_element(games.begin(), games.end()));
+    Board next = board;
+    next.play(nthSquare(moves, best));
+    return next;
+}
+
+// The most visited move of the root, or its first legal move in the rare
+// case that the root could not be expanded at all.
+Board getBestMove(const Node& root, const NodePool& pool) {
+    Board next = root.getBoard();
+    if (root.getNumEdges() > 0) {
+        return root.getEdgeWithMaxVisits(pool).apply(next);
+    }
+    next.play(lowestSquare(next.getLegalMoves()));
+    return next;
+}
+
+// Grows one tree shared by all threads until the deadline.
+void searchTree(Node& root, NodePool& pool, const SearchConfig& config, Deadline deadline) {
+    pool.setBudget(config.maxNodes, config.maxMemory);
+    if (config.table) {
+        config.table->newSearch();
+    }
+    root.expandRoot(pool);
+
+    const bool virtualLoss = config.threads > 1;
+    std::vector<std::thread> helpers;
+    if (!config.observer) {
+        for (size_t i = 1; i < config.threads; ++i) {
+            helpers.emplace_back(runSearch, std::ref(root), std::ref(pool), std::cref(config), virtualLoss, deadline);
+        }
+        runSearch(root, pool, config, virtualLoss, deadline);
+        for (auto& helper : helpers) {
+            helper.join();
+        }
+        return;
+    }
+
+    // With an observer every search thread is a helper, and this thread
+    // reports on them until they are all done.
+    std::atomic<size_t> running(config.threads);
+    for (size_t i = 0; i < config.threads; ++i) {
+        helpers.emplace_back([&root, &pool, &config, &running, virtualLoss, deadline]() {
+            runSearch(root, pool, config, virtualLoss, deadline);
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    const auto start = Clock::now();
+    const auto poll = std::chrono::milliseconds(10);
+    auto nextReport = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(config.infoInterval));
+    while (running.load(std::memory_order_acquire) > 0) {
+        std::this_thread::sleep_for(poll);
+        if (Clock::now() >= nextReport && !root.isLeafNode()) {
+            config.observer->onProgress(root, pool, std::chrono::duration<float>(Clock::now() - start).count());
+            nextReport += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(config.infoInterval));
+        }
+    }
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+Board searchMove(Tree& tree, const SearchConfig& config) {
+    const Board board = tree.getRoot().getBoard();
+    const Bitboard moves = board.getLegalMoves();
+    switch (popCount(moves)) {
+    case 0: {
+        Board next = board;
+        next.pass();
+        return next;
+    }
+    case 1: {
+        Board next = board;
+        next.play(lowestSquare(moves));
+        return next;
+    }
+    default:
+        break;
+    }
+
+    if (config.book) {
+        size_t move;
+        const OpeningBook::Entry* entry;
+        if (config.book->lookup(board, config.bookMinGames, move, entry)) {
+            if (config.verbose) {
+                std::cout << "#book: " << getMoveName(move) << ", games: " << entry->games << ", score: " << entry->score << "\n";
+            }
+            Board next = board;
+            next.play(move);
+            return next;
+        }
+    }
+
+    // The solver only gets a share of the time, so that a solve that does
+    // not finish still leaves the tree search the rest of the move.
+    const float SOLVER_SHARE = 0.5f;
+    Deadline deadline = Deadline::after(config.timeSec, config.stop);
+    if (board.getNumEmpties() <= config.endgameEmpties) {
+        static thread_local EndgameSolver solver;
+        Deadline solverDeadline = Deadline::after(config.timeSec * SOLVER_SHARE, config.stop);
+        size_t move;
+        int score;
+        if (solver.solve(board, solverDeadline, move, score)) {
+            if (config.verbose) {
+                std::cout << "#solved: " << score << ", nodes: " << solver.getNumNodes() << "\n";
+            }
+            Board next = board;
+            next.play(move);
+            return next;
+        }
+    }
+    if (config.parallel == ParallelMode::ROOT && config.threads > 1) {
+        return searchMoveRootParallel(tree, board, config, deadline);
+    }
+
+    Node& root = tree.getRoot();
+    NodePool& pool = tree.getPool();
+    searchTree(root, pool, config, deadline);
+
+    if (config.verbose) {
+        std::cout << "#games: " << root.getNumGames() << ", occupation: " << root.getExpectedOccupation() << "\n";
+        STATS(SearchStats::dump(std::cout));
+    }
+
+    return getBestMove(root, pool);
+}
+
+// How many plies of the principal variation are reported.
+const size_t MAX_PV_LENGTH = 12;
+
+// The most visited line from `root`, e.g. "f5d6c3". It only follows
+// published edges and never allocates, so it can be called while the tree
+// grows.
+std::string getPrincipalVariation(const Node& root, NodePool& pool, size_t maxLength = MAX_PV_LENGTH) {
+    std::string pv;
+    const Node* node = &root;
+    for (size_t ply = 0; ply < maxLength && node->getNumEdges() > 0; ++ply) {
+        const Edge edge = node->getEdgeWithMaxVisits(pool);
+        if (edge.getNumGames() == 0) {
+            break;
+        }
+        pv += getMoveName(edge.getMove());
+        const NodeIndex child = edge.getChild();
+        if (child == Edge::NO_CHILD) {
+            break;
+        }
+        node = &pool.nodes[child];
+    }
+    return pv;
+}
+
+// Grows the tree of the position at its root until `stop` is set, for
+// searching on the opponent's time. Positions without a legal move are left
+// alone, as there is nothing to choose between.
+void ponderTree(Tree& tree, const SearchConfig& config, const std::atomic<bool>& stop) {
+    const float PONDER_SECONDS = 365 * 24 * 3600;
+    if (tree.getRoot().getBoard().getLegalMoves()) {
+        searchTree(tree.getRoot(), tree.getPool(), config, Deadline::after(PONDER_SECONDS, &stop));
+    }
+}
+
+// Ponders on `board` in the background for as long as it lives. Moving
+// the tree on to the reply the opponent picks afterwards keeps the subtree
+// it grew.
+class PonderThread {
+public:
+    PonderThread(Tree& tree, const Board& board, const SearchConfig& config) : stop_(false) {
+        tree.advance(board);
+        thread_ = std::thread(ponderTree, std::ref(tree), config, std::cref(stop_));
+    }
+
+    ~PonderThread() {
+        stop_.store(true, std::memory_order_relaxed);
+        thread_.join();
+    }
+
+private:
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
+
+// Counts the leaves of the game tree `depth` plies down, passes included.
+size_t perft(const Board& board, size_t depth, bool passed = false) {
+    if (depth == 0) {
+        return 1;
+    }
+    Bitboard moves = board.getLegalMoves();
+    if (!moves) {
+        if (passed) {
+            return 1;
+        }
+        Board next = board;
+        next.pass();
+        return perft(next, depth - 1, true);
+    }
+    size_t leaves = 0;
+    for (; moves; moves &= moves - 1) {
+        Board next = board;
+        next.play(lowestSquare(moves));
+        leaves += perft(next, depth - 1, false);
+    }
+    return leaves;
+}
+
+// The bench positions are the start position and two positions further
+// down the line that always takes the first legal move, each with a real
+// choice for the side to move.
+std::vector<Board> getBenchPositions() {
+    const size_t PLIES_APART = (BOARD_CELLS - 4) / 3;
+    std::vector<Board> positions;
+    Board board;
+    for (size_t ply = 0; positions.size() < 3; ++ply) {
+        assert(!board.isGameOver());
+        const Bitboard moves = board.getLegalMoves();
+        if (ply >= positions.size() * PLIES_APART && popCount(moves) > 1) {
+            positions.push_back(board);
+        }
+        if (moves) {
+            board.play(lowestSquare(moves));
+        } else {
+            board.pass();
+        }
+    }
+    return positions;
+}
+
+// Picks a move with a plain tree search and no output, for bench games.
+Board benchMove(Tree& tree, const SearchConfig& config) {
+    const Board board = tree.getRoot().getBoard();
+    const Bitboard moves = board.getLegalMoves();
+    Board next = board;
+    if (!moves) {
+        next.pass();
+    } else if (popCount(moves) == 1) {
+        next.play(lowestSquare(moves));
+    } else {
+        searchTree(tree.getRoot(), tree.getPool(), config, Deadline::after(config.timeSec));
+        next = getBestMove(tree.getRoot(), tree.getPool());
+    }
+    return next;
+}
+
+// Plays `policy` against the uniform policy from seeded random openings,
+// each opening once with either colour, and returns the wins, the losses
+// and the total disc difference from the point of view of `policy`.
+void playBenchMatch(const SearchConfig& config, PlayoutPolicy policy, size_t games, int& wins, int& losses, int& discs) {
+    const size_t OPENING_PLIES = 4;
+    wins = losses = discs = 0;
+    for (size_t game = 0; game < games; ++game) {
+        SearchConfig configs[2] = {config, config};
+        configs[0].policy = PlayoutPolicy::UNIFORM;
+        configs[1].policy = PlayoutPolicy::UNIFORM;
+        const Player player = (game % 2) ? Player::WHITE : Player::BLACK;
+        configs[static_cast<size_t>(player)].policy = policy;
+
+        Board board;
+        SplitMix64 random(game / 2 + 1);
+        for (size_t ply = 0; ply < OPENING_PLIES; ++ply) {
+            const Bitboard moves = board.getLegalMoves();
+            board.play(nthSquare(moves, random() % popCount(moves)));
+        }
+        Tree trees[2];
+        while (!board.isGameOver()) {
+            const size_t side = static_cast<size_t>(board.getPlayer());
+            trees[side].advance(board);
+            board = benchMove(trees[side], configs[side]);
+        }
+        const int diff = static_cast<int>(popCount(board.getDiscs(player))) - static_cast<int>(popCount(board.getDiscs(opponent(player))));
+        wins += (diff > 0);
+        losses += (diff < 0);
+        discs += diff;
+    }
+}
+
+float secondsSince(Clock::time_point start) {
+    return std::chrono::duration<float>(Clock::now() - start).count();
+}
+
+// Prints one line of key=value pairs per measurement, so that runs can be
+// compared by a script. Every MCTS run gets `config.timeSec` seconds.
+void runBench(SearchConfig config) {
+    const size_t PERFT_DEPTH = 9;
+    const size_t BENCH_PLAYOUTS = 100000;
+
+    auto start = Clock::now();
+    const size_t leaves = perft(Board(), PERFT_DEPTH);
+    float seconds = secondsSince(start);
+    std::cout << "perft depth=" << PERFT_DEPTH << " nodes=" << leaves << " seconds=" << seconds
+        << " nodes_per_sec=" << static_cast<size_t>(leaves / seconds) << "\n";
+
+    const std::vector<Board> positions = getBenchPositions();
+    std::vector<Board> boards;
+    std::vector<float> results(BENCH_PLAYOUTS);
+    for (const PlayoutPolicy policy : PLAYOUT_POLICIES) {
+        SearchConfig playoutConfig = config;
+        playoutConfig.policy = policy;
+        for (size_t i = 0; i < positions.size(); ++i) {
+            start = Clock::now();
+            for (size_t n = 0; n < BENCH_PLAYOUTS; ++n) {
+                randomPlayout(positions[i], playoutConfig);
+            }
+            seconds = secondsSince(start);
+            std::cout << "playouts policy=" << getPolicyName(policy) << " position=" << i << " count=" << BENCH_PLAYOUTS
+                << " seconds=" << seconds << " per_sec=" << static_cast<size_t>(BENCH_PLAYOUTS / seconds) << "\n";
+
+            boards.assign(BENCH_PLAYOUTS, positions[i]);
+            start = Clock::now();
+            playoutBatch(boards.data(), results.data(), boards.size(), playoutConfig);
+            seconds = secondsSince(start);
+            std::cout << "batch_playouts policy=" << getPolicyName(policy) << " position=" << i << " lanes=" << PLAYOUT_LANES
+                << " count=" << BENCH_PLAYOUTS << " seconds=" << seconds
+                << " per_sec=" << static_cast<size_t>(BENCH_PLAYOUTS / seconds) << "\n";
+        }
+    }
+
+    // Short games against the uniform policy, as a check that a policy
+    // buys better moves than it costs in playouts.
+    const size_t MATCH_GAMES = 8;
+    SearchConfig matchConfig = config;
+    matchConfig.timeSec = config.timeSec / 50;
+    matchConfig.threads = 1;
+    for (const PlayoutPolicy policy : PLAYOUT_POLICIES) {
+        if (policy == PlayoutPolicy::UNIFORM) {
+            continue;
+        }
+        int wins, losses, discs;
+        playBenchMatch(matchConfig, policy, MATCH_GAMES, wins, losses, discs);
+        std::cout << "match policy=" << getPolicyName(policy) << " opponent=uniform games=" << MATCH_GAMES
+            << " seconds_per_move=" << matchConfig.timeSec << " wins=" << wins << " losses=" << losses
+            << " avg_discs=" << static_cast<float>(discs) / MATCH_GAMES << "\n";
+    }
+
+    STATS(SearchStats::local() = SearchStats());
+    const size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), config.threads);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        config.threads = threads;
+        size_t iterations = 0;
+        size_t peakMemory = 0;
+        for (const Board& position : positions) {
+            Tree tree;
+            tree.reset(position);
+            searchTree(tree.getRoot(), tree.getPool(), config, Deadline::after(config.timeSec));
+            iterations += tree.getRoot().getNumGames();
+            peakMemory = std::max(peakMemory, tree.getPool().getMemoryUsage());
+        }
+        seconds = config.timeSec * positions.size();
+        std::cout << "mcts threads=" << threads << " iterations=" << iterations << " seconds=" << seconds
+            << " per_sec=" << static_cast<size_t>(iterations / seconds) << " peak_memory=" << peakMemory << "\n";
+        STATS(SearchStats::dump(std::cout));
+    }
+    std::cout.flush();
+}
+
+// The square that was played between two consecutive positions, or
+// PASS_MOVE if no disc was added.
+size_t getPlayedSquare(const Board& from, const Board& to) {
+    const Bitboard before = from.getDiscs(Player::BLACK) | from.getDiscs(Player::WHITE);
+    const Bitboard placed = (to.getDiscs(Player::BLACK) | to.getDiscs(Player::WHITE)) & ~before;
+    return placed ? lowestSquare(placed) : PASS_MOVE;
+}
+
+// A line-based protocol for running the engine under a match runner or a
+// server, one command per line on stdin and one response per line on stdout:
+//
+//   newgame               back to the start position, with a fresh tree
+//   setboard CELLS [X|O]  a position as BOARD_CELLS of `X`, `O` and `.`, row
+//                         by row, and the side to move (default X)
+//   move M...             plays one or more moves, e.g. `move f5d6`
+//   go [T]                searches for T seconds (default: the `time`
+//                         argument), streaming `info` lines, then answers
+//                         `bestmove M`. The move is not played.
+//   ponder                grows the tree from the current position until
+//                         `stop` or the next command, streaming `info` lines
+//   stop                  ends a running `go` early, which still answers
+//                         with its best move so far, or a `ponder`
+//   info                  one `info` line for the current tree
+//   isready               `readyok`, also while searching
+//   board                 `board CELLS X|O` in the `setboard` format
+//   savetree FILE [V]     writes the tree to FILE, keeping the nodes
+//                         visited at least V times (default 1)
+//   loadtree FILE         carries on from a tree written by `savetree`,
+//                         and its position
+//   quit
+//
+// Every command other than `isready` and `info` first stops a running
+// search. The tree, the transposition table and the book stay with the
+// process from one game to the next. Anything that fails answers `error`.
+class Protocol : public SearchObserver {
+public:
+    explicit Protocol(const SearchConfig& config) : config_(config), stop_(false) {
+        config_.verbose = false;
+        config_.stop = &stop_;
+        config_.observer = this;
+        tree_.reset(board_);
+    }
+
+    ~Protocol() {
+        stopSearch();
+    }
+
+    void run(std::istream& in) {
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream args(line);
+            std::string command;
+            if (!(args >> command)) {
+                continue;
+            }
+            if (command == "isready") {
+                respond("readyok");
+                continue;
+            }
+            if (command == "info") {
+                respond(getInfo());
+                continue;
+            }
+            stopSearch();
+            if (command == "quit") {
+                return;
+            } else if (command == "newgame") {
+                board_ = Board();
+                tree_.reset(board_);
+            } else if (command == "setboard") {
+                setBoard(args);
+            } else if (command == "move") {
+                playMoves(args);
+            } else if (command == "go") {
+                go(args);
+            } else if (command == "ponder") {
+                ponder();
+            } else if (command == "board") {
+                respond("board " + getBoardString(board_));
+            } else if (command == "savetree") {
+                saveTree(args);
+            } else if (command == "loadtree") {
+                loadTree(args);
+            } else if (command != "stop") {
+                respond("error unknown command " + command);
+            }
+        }
+    }
+
+    void onProgress(Node&, NodePool&, float elapsedSec) {
+        std::ostringstream seconds;
+        seconds << " seconds=" << elapsedSec;
+        respond(getInfo() + seconds.str());
+    }
+
+private:
+
+    SearchConfig config_;
+    Tree tree_;
+    Board board_;
+    std::atomic<bool> stop_;
+    std::thread search_;
+    std::mutex output_;
+
+    void respond(const std::string& line) {
+        std::lock_guard<std::mutex> lock(output_);
+        std::cout << line << '\n';
+        std::cout.flush();
+    }
+
+    void stopSearch() {
+        if (search_.joinable()) {
+            stop_.store(true, std::memory_order_relaxed);
+            search_.join();
+            stop_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    std::string getInfo() {
+        Node& root = tree_.getRoot();
+        NodePool& pool = tree_.getPool();
+        std::ostringstream info;
+        info << "info games=" << root.getNumGames() << " occupation=" << root.getExpectedOccupation()
+            << " nodes=" << pool.nodes.size();
+        if (root.getNumEdges() > 0) {
+            const Edge best = root.getEdgeWithMaxVisits(pool);
+            info << " best=" << getMoveName(best.getMove()) << " best_games=" << best.getNumGames()
+                << " best_occupation=" << best.getMean();
+        }
+        const std::string pv = getPrincipalVariation(root, pool);
+        if (!pv.empty()) {
+            info << " pv=" << pv;
+        }
+        return info.str();
+    }
+
+    void setBoard(std::istream& args) {
+        std::string cells, player = "X";
+        args >> cells >> player;
+        if (!parseBoardString(cells, player, board_)) {
+            respond("error setboard needs " + std::to_string(BOARD_CELLS) + " cells of X, O and ., and X or O to move");
+            return;
+        }
+        tree_.advance(board_);
+    }
+
+    void playMoves(std::istream& args) {
+        std::string moves;
+        std::vector<size_t> squares;
+        args >> moves;
+        if (moves.empty() || !parseMoves(moves, board_, squares)) {
+            respond("error illegal move " + moves);
+            return;
+        }
+        for (const size_t square : squares) {
+            if (square == PASS_MOVE) {
+                board_.pass();
+            } else {
+                board_.play(square);
+            }
+        }
+        tree_.advance(board_);
+    }
+
+    void saveTree(std::istream& args) {
+        std::string path;
+        size_t minVisits = 1;
+        args >> path >> minVisits;
+        std::ofstream out(path, std::ios::binary);
+        if (path.empty() || !tree_.save(out, minVisits)) {
+            respond("error cannot write tree " + path);
+        }
+    }
+
+    void loadTree(std::istream& args) {
+        std::string path;
+        args >> path;
+        std::ifstream in(path, std::ios::binary);
+        if (path.empty() || !tree_.load(in, config_.table)) {
+            respond("error cannot read tree " + path);
+            return;
+        }
+        board_ = tree_.getRoot().getBoard();
+    }
+
+    void go(std::istream& args) {
+        if (board_.isGameOver()) {
+            respond("error game over");
+            return;
+        }
+        float seconds;
+        SearchConfig config = config_;
+        if (args >> seconds) {
+            config.timeSec = seconds;
+        }
+        search_ = std::thread([this, config]() {
+            const Board next = searchMove(tree_, config);
+            respond("bestmove " + getMoveName(getPlayedSquare(board_, next)));
+        });
+    }
+
+    void ponder() {
+        search_ = std::thread(ponderTree, std::ref(tree_), config_, std::cref(stop_));
+    }
+};
+
+// Runs jobs 0..jobs-1 on `workers` threads, each thread taking the next job
+// as soon as it is done with one. `job` is called as job(worker, index).
+template<typename Job>
+void runJobs(size_t workers, size_t jobs, Job job) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&next, &job, jobs, worker]() {
+            for (size_t index; (index = next.fetch_add(1, std::memory_order_relaxed)) < jobs;) {
+                job(worker, index);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// What one worker of the self-play and analysis drivers searches with.
+// Workers never share a tree or a transposition table, and every worker
+// thread draws from its own RNG; only the book is shared.
+struct Worker {
+    Tree tree;
+    NodeTable table;
+    SearchConfig config;
+
+    explicit Worker(const SearchConfig& base) : config(base) {
+        config.verbose = false;
+        if (base.table) {
+            table.resizeLike(*base.table);
+            config.table = &table;
+        }
+    }
+};
+
+std::vector<std::unique_ptr<Worker>> makeWorkers(size_t n, const SearchConfig& config) {
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < n; ++i) {
+        workers.emplace_back(new Worker(config));
+    }
+    return workers;
+}
+
+// Records one ply of a self-play game: the visits and the mean result of
+// the move played at the root of the tree, or 0 and "-" if the tree has
+// no visits for it (random opening moves, and book or forced moves out of
+// a fresh tree).
+void recordPly(Tree& tree, const Board& board, size_t square, std::string& moves,
+               std::ostringstream& visits, std::ostringstream& scores) {
+    const char* separator = moves.empty() ? "" : ",";
+    moves += getMoveName(square);
+    Node& root = tree.getRoot();
+    if (root.getBoard() == board) {
+        for (size_t i = 0; i < root.getNumEdges(); ++i) {
+            const Edge edge = root.getEdge(tree.getPool(), i);
+            if (edge.getMove() == square && edge.getNumGames() > 0) {
+                visits << separator << edge.getNumGames();
+                scores << separator << edge.getMean();
+                return;
+            }
+        }
+    }
+    visits << separator << 0;
+    scores << separator << '-';
+}
+
+// Plays `games` games of the engine against itself on `workers` threads
+// and prints one record per game as it finishes, in the format read by
+// --build-book:
+//
+//   game id=3 moves=f5d6c3... result=4 visits=0,0,51234,... scores=-,-,0.512,...
+//
+// `result` is black's final disc difference, and `visits` and `scores` hold
+// one entry per ply. The first `openingPlies` plies are random, so that the
+// games spread out; every side gets its own copy of `timer`.
+void runSelfPlay(const SearchConfig& config, const TimeManager& timer, size_t games, size_t workers, size_t openingPlies) {
+    std::vector<std::unique_ptr<Worker>> states = makeWorkers(workers, config);
+    std::mutex output;
+    std::atomic<size_t> blackWins(0), whiteWins(0);
+    const auto start = Clock::now();
+    runJobs(workers, games, [&](size_t workerIndex, size_t game) {
+        Worker& worker = *states[workerIndex];
+        RNG& rng = RNG::getSingleton();
+        Board board;
+        TimeManager clocks[2] = {timer, timer};
+        std::string moves;
+        std::ostringstream visits, scores;
+        scores << std::setprecision(3);
+        worker.tree.reset(board);
+        for (size_t ply = 0; !board.isGameOver(); ++ply) {
+            Board next = board;
+            const Bitboard legal = board.getLegalMoves();
+            if (ply < openingPlies) {
+                if (legal) {
+                    next.play(rng.randomSquare(legal));
+                } else {
+                    next.pass();
+                }
+            } else {
+                TimeManager& clock = clocks[static_cast<size_t>(board.getPlayer())];
+                worker.tree.advance(board);
+                worker.config.timeSec = clock.allocate(board);
+                const auto moveStart = Clock::now();
+                next = searchMove(worker.tree, worker.config);
+                clock.charge(secondsSince(moveStart));
+            }
+            recordPly(worker.tree, board, getPlayedSquare(board, next), moves, visits, scores);
+            board = next;
+        }
+
+        const int result = static_cast<int>(popCount(board.getDiscs(Player::BLACK)))
+            - static_cast<int>(popCount(board.getDiscs(Player::WHITE)));
+        blackWins += (result > 0);
+        whiteWins += (result < 0);
+        std::lock_guard<std::mutex> lock(output);
+        std::cout << "game id=" << game << " moves=" << moves << " result=" << result
+            << " visits=" << visits.str() << " scores=" << scores.str() << '\n';
+        std::cout.flush();
+    });
+    std::cout << "selfplay games=" << games << " black_wins=" << blackWins << " white_wins=" << whiteWins
+        << " draws=" << games - blackWins - whiteWins << " seconds=" << secondsSince(start) << '\n';
+}
+
+// Searches every position of `in`, one per line in the `setboard` format,
+// on `workers` threads and prints one record per position as it is done:
+//
+//   position id=0 best=d3 games=51234 score=0.512 pv=d3c5f6...
+//
+// where `score` is the mean result of the best move for the side to move.
+// Blank lines and comment lines, whose first non-blank character is `#`, are
+// skipped and not counted.
+void runAnalysis(const SearchConfig& config, std::istream& in, size_t workers) {
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start != std::string::npos && line[start] != '#') {
+            lines.push_back(line);
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> states = makeWorkers(workers, config);
+    std::mutex output;
+    runJobs(workers, lines.size(), [&](size_t workerIndex, size_t id) {
+        Worker& worker = *states[workerIndex];
+        std::istringstream fields(lines[id]);
+        std::string cells, player = "X";
+        fields >> cells >> player;
+        std::ostringstream record;
+        record << "position id=" << id;
+        Board board;
+        if (!parseBoardString(cells, player, board)) {
+            record << " error=bad_position";
+        } else if (board.isGameOver()) {
+            record << " error=game_over";
+        } else {
+            worker.tree.reset(board);
+            const Board next = searchMove(worker.tree, worker.config);
+            Node& root = worker.tree.getRoot();
+            record << " best=" << getMoveName(getPlayedSquare(board, next)) << " games=" << root.getNumGames();
+            if (root.getNumEdges() > 0) {
+                record << " score=" << std::setprecision(3) << root.getEdgeWithMaxVisits(worker.tree.getPool()).getMean()
+                    << " pv=" << getPrincipalVariation(root, worker.tree.getPool());
+            }
+        }
+        std::lock_guard<std::mutex> lock(output);
+        std::cout << record.str() << '\n';
+        std::cout.flush();
+    });
+}
+
+int main(int argc, char** argv) {
+    SearchConfig config;
+    TimeManager timer;
+    NodeTable table;
+    OpeningBook book;
+    float totalTime = 0, increment = 0;
+    bool bench = false, protocol = false, ponder = false;
+    size_t tableMegabytes = 0;
+    size_t selfPlayGames = 0, workers = 0, openingPlies = 4;
+    std::string analyzeFile;
+    std::string bookLog, bookOut;
+    size_t bookPlies = 20;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            config.threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            RNG::setSeed(strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--parallel" && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            config.parallel = (mode == "root") ? ParallelMode::ROOT : ParallelMode::TREE;
+        } else if (arg == "--endgame-empties" && i + 1 < argc) {
+            config.endgameEmpties = atoi(argv[++i]);
+        } else if (arg == "--exact-leaf-empties" && i + 1 < argc) {
+            config.exactLeafEmpties = atoi(argv[++i]);
+        } else if (arg == "--tt-size" && i + 1 < argc) {
+            tableMegabytes = atoi(argv[++i]);
+        } else if (arg == "--tt-replace" && i + 1 < argc) {
+            const std::string policy = argv[++i];
+            table.setReplacement(policy == "visits" ? NodeTable::Replacement::VISITS : NodeTable::Replacement::ALWAYS);
+        } else if (arg == "--max-nodes" && i + 1 < argc) {
+            config.maxNodes = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--max-memory" && i + 1 < argc) {
+            config.maxMemory = strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            config.batchSize = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--playouts-per-leaf" && i + 1 < argc) {
+            config.playoutsPerLeaf = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--cp" && i + 1 < argc) {
+            config.exploration = atof(argv[++i]);
+        } else if (arg == "--playout-policy" && i + 1 < argc) {
+            const std::string policy = argv[++i];
+            config.policy = (policy == "uniform") ? PlayoutPolicy::UNIFORM : PlayoutPolicy::HEURISTIC;
+        } else if (arg == "--playout-cutoff" && i + 1 < argc) {
+            config.playoutCutoff = atoi(argv[++i]);
+        } else if (arg == "--expand-threshold" && i + 1 < argc) {
+            config.expandThreshold = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--book" && i + 1 < argc) {
+            if (!book.open(argv[++i])) {
+                std::cerr << "cannot open book " << argv[i] << std::endl;
+                return 1;
+            }
+            config.book = &book;
+        } else if (arg == "--book-min-games" && i + 1 < argc) {
+            config.bookMinGames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--build-book" && i + 2 < argc) {
+            bookLog = argv[++i];
+            bookOut = argv[++i];
+        } else if (arg == "--book-plies" && i + 1 < argc) {
+            bookPlies = atoi(argv[++i]);
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--protocol") {
+            protocol = true;
+        } else if (arg == "--ponder") {
+            ponder = true;
+        } else if (arg == "--selfplay" && i + 1 < argc) {
+            selfPlayGames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--analyze" && i + 1 < argc) {
+            analyzeFile = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--opening-plies" && i + 1 < argc) {
+            openingPlies = atoi(argv[++i]);
+        } else if (arg == "--time-total" && i + 1 < argc) {
+            totalTime = atof(argv[++i]);
+        } else if (arg == "--increment" && i + 1 < argc) {
+            increment = atof(argv[++i]);
+        } else {
+            timer.setMoveTime(atof(argv[i]));
+        }
+    }
+    if (totalTime > 0) {
+        timer.setGameTime(totalTime, increment);
+    }
+    if (tableMegabytes > 0) {
+        // The drivers give every worker a table of its own.
+        if (selfPlayGames > 0 || !analyzeFile.empty()) {
+            table.setSize(tableMegabytes);
+        } else {
+            table.resize(tableMegabytes);
+        }
+        config.table = &table;
+    }
+    if (!bookLog.empty()) {
+        std::ifstream log(bookLog);
+        if (!log || !OpeningBook::build(log, bookOut, bookPlies)) {
+            std::cerr << "cannot build book " << bookOut << " from " << bookLog << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (bench) {
+        config.timeSec = timer.allocate(Board());
+        runBench(config);
+        return 0;
+    }
+    if (workers == 0) {
+        workers = std::max<size_t>(1, std::thread::hardware_concurrency() / config.threads);
+    }
+    if (selfPlayGames > 0) {
+        runSelfPlay(config, timer, selfPlayGames, workers, openingPlies);
+        return 0;
+    }
+    if (!analyzeFile.empty()) {
+        std::ifstream positions(analyzeFile);
+        if (!positions) {
+            std::cerr << "cannot open positions " << analyzeFile << std::endl;
+            return 1;
+        }
+        config.timeSec = timer.allocate(Board());
+        runAnalysis(config, positions, workers);
+        return 0;
+    }
+    if (protocol) {
+        config.timeSec = timer.allocate(Board());
+        Protocol(config).run(std::cin);
+        return 0;
+    }
+
+    Tree tree;
+    Board current;
+    current.print();
+
+    std::string str;
+    while (!current.isGameOver()) {
+        if (current.getLegalMoves()) {
+            std::unique_ptr<PonderThread> ponderThread;
+            if (ponder) {
+                ponderThread.reset(new PonderThread(tree, current, config));
+            }
+            while (true) {
+                std::cout << "move? ";
+                if (!(std::cin >> str)) {
+                    return 0;
+                }
+                const size_t x = tolower(str[0]) - 'a';
+                const size_t y = str.size() > 1 ? atoi(str.c_str() + 1) - 1 : BOARD_SIZE;
+                if (current.put(x, y)) {
+                    break;
+                }
+            }
+        } else {
+            std::cout << "pass\n";
+            current.pass();
         }
         current.print();
-        current.flipPlayer();
 
-        current = searchMove(current, time);
+        tree.advance(current);
+        config.timeSec = timer.allocate(current);
+        const auto start = Clock::now();
+        current = searchMove(tree, config);
+        timer.charge(std::chrono::duration<float>(Clock::now() - start).count());
+        tree.advance(current);
         current.print();
     }
 